@@ -111,19 +111,54 @@ paddr_t ram_stealmem(unsigned long npages);
 paddr_t ram_getsize(void);
 paddr_t ram_getfirstfree(void);
 
+/*
+ * Per-CPU cache of free single frames, kept in struct cpu so that
+ * most single-page allocations and frees don't touch the frame
+ * table lock. Only the owning CPU touches it, at splhigh. Frames in
+ * the cache are marked allocated in the frame table. It is refilled
+ * and drained FRAMECACHE_BATCH frames at a time.
+ */
+
+#define FRAMECACHE_SIZE  32
+#define FRAMECACHE_BATCH 16
+
+struct framecache {
+	unsigned fc_count;
+	paddr_t fc_frames[FRAMECACHE_SIZE];
+};
+
+/*
+ * Per-CPU TLB counters, also in struct cpu, bumped by the owning CPU
+ * at splhigh. vm_printtlbstats sums them over all CPUs.
+ */
+struct tlbstats {
+	unsigned tlbs_misses;		/* TLB miss exceptions */
+	unsigned tlbs_refills;		/* misses served from the page table */
+	unsigned tlbs_prefetches;	/* neighbours loaded on a miss */
+	unsigned tlbs_flushes;		/* whole-TLB invalidations */
+	unsigned tlbs_flushskips;	/* switches that kept the TLB */
+	unsigned tlbs_shootdowns;	/* shootdown requests handled */
+};
+
 /*
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct semaphore;
+
+/*
+ * ts_vaddr is the page to invalidate, or TLBSHOOTDOWN_ALL for the
+ * whole TLB. The receiving CPU V()s ts_done once it has done it.
+ */
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;
+	struct semaphore *ts_done;
 };
 
+#define TLBSHOOTDOWN_ALL ((vaddr_t)-1)
+
 #define TLBSHOOTDOWN_MAX 16
 
 
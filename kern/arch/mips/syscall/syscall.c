@@ -34,10 +34,351 @@
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
+#include <spl.h>
 #include <syscall.h>
+#include <addrspace.h>
 
 #include <copyinout.h>
 #include <endian.h>
+#include "opt-dumbvm.h"
+
+/*
+ * Argument-marshalling shims.
+ *
+ * Each shim unpacks one system call's arguments from the trapframe
+ * (and, past the four argument registers, from the user stack),
+ * calls the in-kernel implementation, and on success leaves the
+ * return value in rv[0] (v0), plus rv[1] (v1) for calls marked as
+ * returning 64 bits. It returns 0 or an error code.
+ */
+
+typedef int (*syscall_shim)(struct trapframe *tf, int32_t rv[2]);
+
+/* fetch a 64-bit argument from the first two stack slots */
+static
+int
+stack_arg64(struct trapframe *tf, uint64_t *ret)
+{
+	return copyin((userptr_t)tf->tf_sp + 16, ret, sizeof(*ret));
+}
+
+static
+int
+sc_reboot(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_reboot(tf->tf_a0);
+}
+
+static
+int
+sc___time(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_fork(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_fork(tf, &rv[0]);
+}
+
+static
+int
+sc_vfork(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_vfork(tf, &rv[0]);
+}
+
+static
+int
+sc_execv(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_getpid(struct trapframe *tf, int32_t rv[2])
+{
+	(void)tf;
+	return sys_getpid(&rv[0]);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2, &rv[0]);
+}
+
+/* never returns, so _exit isn't counted in the stats */
+static
+int
+sc__exit(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	sys__exit((int)tf->tf_a0);
+}
+
+#if !OPT_DUMBVM
+static
+int
+sc_sbrk(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_sbrk((intptr_t)tf->tf_a0, &rv[0]);
+}
+
+/* fd is the fifth word; the 64-bit pos after it is aligned, at sp+24 */
+static
+int
+sc_mmap(struct trapframe *tf, int32_t rv[2])
+{
+	uint64_t pos;
+	int fd;
+	int err;
+
+	err = copyin((userptr_t)tf->tf_sp + 16, &fd, sizeof(int));
+	if (err) {
+		return err;
+	}
+	err = copyin((userptr_t)tf->tf_sp + 24, &pos, sizeof(pos));
+	if (err) {
+		return err;
+	}
+	return sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			(int)tf->tf_a2, (int)tf->tf_a3, fd, pos, &rv[0]);
+}
+
+static
+int
+sc_munmap(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+}
+
+static
+int
+sc_msync(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			 (int)tf->tf_a2);
+}
+
+static
+int
+sc_madvise(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_madvise((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			   (int)tf->tf_a2);
+}
+
+static
+int
+sc_mincore(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_mincore((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			   (userptr_t)tf->tf_a2);
+}
+#endif
+
+static
+int
+sc_open(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+			(mode_t)tf->tf_a2, &rv[0]);
+}
+
+static
+int
+sc_close(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys_close((int)tf->tf_a0);
+}
+
+static
+int
+sc_read(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			(size_t)tf->tf_a2, &rv[0]);
+}
+
+static
+int
+sc_write(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_write((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2, &rv[0]);
+}
+
+/* 64-bit pos is aligned, so it lands on the stack after fd/buf/len */
+static
+int
+sc_pread(struct trapframe *tf, int32_t rv[2])
+{
+	uint64_t pos;
+	int err;
+
+	err = stack_arg64(tf, &pos);
+	if (err) {
+		return err;
+	}
+	return sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2, pos, &rv[0]);
+}
+
+static
+int
+sc_pwrite(struct trapframe *tf, int32_t rv[2])
+{
+	uint64_t pos;
+	int err;
+
+	err = stack_arg64(tf, &pos);
+	if (err) {
+		return err;
+	}
+	return sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			  (size_t)tf->tf_a2, pos, &rv[0]);
+}
+
+static
+int
+sc_readv(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_readv((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, &rv[0]);
+}
+
+static
+int
+sc_writev(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_writev((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2, &rv[0]);
+}
+
+static
+int
+sc_preadv(struct trapframe *tf, int32_t rv[2])
+{
+	uint64_t pos;
+	int err;
+
+	err = stack_arg64(tf, &pos);
+	if (err) {
+		return err;
+	}
+	return sys_preadv((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2, pos, &rv[0]);
+}
+
+static
+int
+sc_pwritev(struct trapframe *tf, int32_t rv[2])
+{
+	uint64_t pos;
+	int err;
+
+	err = stack_arg64(tf, &pos);
+	if (err) {
+		return err;
+	}
+	return sys_pwritev((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2, pos, &rv[0]);
+}
+
+/* 64-bit pos in a2/a3 (a1 unused), whence in the first stack slot */
+static
+int
+sc_lseek(struct trapframe *tf, int32_t rv[2])
+{
+	uint64_t pos;
+	off_t result;
+	int whence;
+	int err;
+
+	err = copyin((userptr_t)tf->tf_sp + 16, &whence, sizeof(int));
+	if (err) {
+		return err;
+	}
+	join32to64(tf->tf_a2, tf->tf_a3, &pos);
+	err = sys_lseek((int)tf->tf_a0, pos, whence, &result);
+	if (err) {
+		return err;
+	}
+	split64to32(result, (uint32_t *)&rv[0], (uint32_t *)&rv[1]);
+	return 0;
+}
+
+static
+int
+sc_dup2(struct trapframe *tf, int32_t rv[2])
+{
+	return sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, &rv[0]);
+}
+
+static
+int
+sc___syscallstat(struct trapframe *tf, int32_t rv[2])
+{
+	(void)rv;
+	return sys___syscallstat((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+/*
+ * The dispatch table, indexed by syscall number. Unimplemented calls
+ * have no shim.
+ */
+static const struct {
+	const char *name;
+	syscall_shim shim;
+	bool ret64;		/* returns 64 bits in v0/v1 */
+} syscalltable[SYSCALL_MAX] = {
+	[SYS_reboot] =		{ "reboot",		sc_reboot,	false },
+	[SYS___time] =		{ "__time",		sc___time,	false },
+	[SYS_fork] =		{ "fork",		sc_fork,	false },
+	[SYS_vfork] =		{ "vfork",		sc_vfork,	false },
+	[SYS_execv] =		{ "execv",		sc_execv,	false },
+	[SYS__exit] =		{ "_exit",		sc__exit,	false },
+	[SYS_waitpid] =		{ "waitpid",		sc_waitpid,	false },
+	[SYS_getpid] =		{ "getpid",		sc_getpid,	false },
+#if !OPT_DUMBVM
+	[SYS_sbrk] =		{ "sbrk",		sc_sbrk,	false },
+	[SYS_mmap] =		{ "mmap",		sc_mmap,	false },
+	[SYS_munmap] =		{ "munmap",		sc_munmap,	false },
+	[SYS_madvise] =		{ "madvise",		sc_madvise,	false },
+	[SYS_mincore] =		{ "mincore",		sc_mincore,	false },
+#endif
+	[SYS_open] =		{ "open",		sc_open,	false },
+	[SYS_close] =		{ "close",		sc_close,	false },
+	[SYS_read] =		{ "read",		sc_read,	false },
+	[SYS_write] =		{ "write",		sc_write,	false },
+	[SYS_pread] =		{ "pread",		sc_pread,	false },
+	[SYS_pwrite] =		{ "pwrite",		sc_pwrite,	false },
+	[SYS_readv] =		{ "readv",		sc_readv,	false },
+	[SYS_writev] =		{ "writev",		sc_writev,	false },
+	[SYS_preadv] =		{ "preadv",		sc_preadv,	false },
+	[SYS_pwritev] =		{ "pwritev",		sc_pwritev,	false },
+	[SYS_lseek] =		{ "lseek",		sc_lseek,	true },
+	[SYS_dup2] =		{ "dup2",		sc_dup2,	false },
+	[SYS___syscallstat] =	{ "__syscallstat",	sc___syscallstat, false },
+#if !OPT_DUMBVM
+	[SYS_msync] =		{ "msync",		sc_msync,	false },
+#endif
+};
 
 /*
  * System call dispatcher.
@@ -76,93 +417,74 @@
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * Each call is counted in the current CPU's c_syscallstats, along
+ * with whether it failed and how many cycles it took, unless it
+ * finished on a different CPU than it started on.
  */
 void
 syscall(struct trapframe *tf)
 {
 	int callno;
-	int32_t retval;
+	int32_t rv[2];
 	int err;
-	off_t retval64;
-	
-	int whence;
-	uint64_t offset;
+	uint32_t start;
+	struct cpu *startcpu;
+	struct syscall_stat *stat;
+	int spl;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
-	err = 0;
 
 	/*
-	 * Initialize retval to 0. Many of the system calls don't
-	 * really return a value, just 0 for success and -1 on
-	 * error. Since retval is the value returned on success,
-	 * initialize it to 0 by default; thus it's not necessary to
-	 * deal with it except for calls that return other values,
-	 * like write.
+	 * Initialize the return value to 0. Many of the system calls
+	 * don't really return a value, just 0 for success and -1 on
+	 * error. Since the return value is what's passed back on
+	 * success, initialize it to 0 by default; thus it's not
+	 * necessary to deal with it except for calls that return
+	 * other values, like write.
 	 */
 
-	retval = 0;
-	retval64 = 0;
-
-	switch (callno) {
-
-	    case SYS_reboot:
-			err = sys_reboot(tf->tf_a0);
-			break;
-
-	    case SYS___time:
-			err = sys___time((userptr_t)tf->tf_a0,
-				(userptr_t)tf->tf_a1);
-			break;
-
-        case SYS__exit:
-			kprintf("exit() was called, but it's unimplemented.\n");
-			kprintf("This is expected if your user-level program has finished.\n");
-			panic("Can't continue further until sys_exit() is implemented");
-			break;
-
-	    /* Add stuff here */
-
-		case SYS_open:
-			// kprintf("OPEN CASE\n");
-			retval = sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1, (mode_t)tf->tf_a2);
-			// kprintf("OPENED %d\n", retval);
-			break;
-
-		case SYS_close:
-			retval = sys_close((int)tf->tf_a0);
-			break;
-		
-		case SYS_read:
-			// kprintf("READING\n");
-			retval = sys_read((int)tf->tf_a0, (void *)tf->tf_a1, (size_t)tf->tf_a2);
-			break;	
-
-		case SYS_write:
-			// kprintf("WRITE CASE\n");
-			retval = (int32_t)sys_write((int)tf->tf_a0, (const void *)tf->tf_a1, (size_t)tf->tf_a2);
-			// kprintf("WRITTEN %d\n", retval);
-			break;
-
-		case SYS_lseek:
-			copyin((userptr_t)tf->tf_sp + 16, &whence, sizeof(int));
-			join32to64(tf->tf_a2, tf->tf_a3, &offset);
-			retval64 = sys_lseek((int)tf->tf_a0, offset, whence);
-			break;
-		
-		case SYS_dup2:
-			retval = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1);
-			break;
-
-	    default:
-			kprintf("unknown syscall %d\n", callno);
-			err = ENOSYS;
-			break;
+	rv[0] = 0;
+	rv[1] = 0;
+
+	if (callno < 0 || callno >= SYSCALL_MAX ||
+	    syscalltable[callno].shim == NULL) {
+		kprintf("unknown syscall %d\n", callno);
+		err = ENOSYS;
 	}
+	else {
+		/* Note the cpu too: other cpus' counters are unrelated. */
+		spl = splhigh();
+		startcpu = curcpu;
+		start = cpu_cycles();
+		splx(spl);
+
+		err = syscalltable[callno].shim(tf, rv);
 
+		/*
+		 * Raise spl while counting so another thread on this
+		 * cpu can't interleave its update, and so we stay on
+		 * the cpu whose counters we're updating. If the call
+		 * slept and woke up on another cpu, it can't be timed.
+		 */
+		spl = splhigh();
+		stat = &curcpu->c_syscallstats[callno];
+		stat->ss_calls++;
+		if (err) {
+			stat->ss_errors++;
+		}
+		if (curcpu == startcpu) {
+			stat->ss_cycles += cpu_cycles() - start;
+		}
+		else {
+			stat->ss_untimed++;
+		}
+		splx(spl);
+	}
 
 	if (err) {
 		/*
@@ -172,15 +494,14 @@ syscall(struct trapframe *tf)
 		 */
 		tf->tf_v0 = err;
 		tf->tf_a3 = 1;      /* signal an error */
-		// kprintf("error err%d\n", err);
-
 	}
 	else {
 		/* Success. */
-		if (retval64) split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
-		tf->tf_v0 = retval;
+		tf->tf_v0 = rv[0];
+		if (syscalltable[callno].ret64) {
+			tf->tf_v1 = rv[1];
+		}
 		tf->tf_a3 = 0;      /* signal no error */
-		// kprintf("success retval%d\n", retval);
 	}
 
 	/*
@@ -197,15 +518,95 @@ syscall(struct trapframe *tf)
 }
 
 /*
- * Enter user mode for a newly forked process.
- *
- * This function is provided as a reminder. You need to write
- * both it and the code that calls it.
- *
- * Thus, you can trash it and do things another way if you prefer.
+ * Sum one syscall's counters over all CPUs. The counters are read
+ * without synchronization, so a call in progress elsewhere may or
+ * may not be included.
+ */
+int
+syscall_getstat(int callno, struct syscall_stat *ret)
+{
+	struct syscall_stat *stat;
+	unsigned i;
+
+	if (callno < 0 || callno >= SYSCALL_MAX) {
+		return EINVAL;
+	}
+
+	ret->ss_calls = 0;
+	ret->ss_errors = 0;
+	ret->ss_untimed = 0;
+	ret->ss_cycles = 0;
+	for (i=0; i<cpu_count(); i++) {
+		stat = &cpu_get(i)->c_syscallstats[callno];
+		ret->ss_calls += stat->ss_calls;
+		ret->ss_errors += stat->ss_errors;
+		ret->ss_untimed += stat->ss_untimed;
+		ret->ss_cycles += stat->ss_cycles;
+	}
+	return 0;
+}
+
+/*
+ * Print the counters of every syscall that has been called.
+ */
+void
+syscall_printstats(void)
+{
+	struct syscall_stat stat;
+	unsigned timed;
+	int i;
+
+	kprintf("%-16s %10s %8s %8s %14s %10s\n",
+		"syscall", "calls", "errors", "untimed", "cycles", "avg");
+	for (i=0; i<SYSCALL_MAX; i++) {
+		syscall_getstat(i, &stat);
+		if (stat.ss_calls == 0) {
+			continue;
+		}
+		timed = stat.ss_calls - stat.ss_untimed;
+		kprintf("%-16s %10u %8u %8u %14llu %10llu\n",
+			syscalltable[i].name ? syscalltable[i].name : "?",
+			stat.ss_calls, stat.ss_errors, stat.ss_untimed,
+			stat.ss_cycles,
+			timed > 0 ? stat.ss_cycles / timed : 0ULL);
+	}
+}
+
+/*
+ * Userlevel access to the counters.
+ */
+int
+sys___syscallstat(int callno, userptr_t user_stat)
+{
+	struct syscall_stat stat;
+	int result;
+
+	result = syscall_getstat(callno, &stat);
+	if (result) {
+		return result;
+	}
+	return copyout(&stat, user_stat, sizeof(stat));
+}
+
+/*
+ * Enter user mode for a newly forked process. TF is the heap copy of
+ * the parent's trapframe made by sys_fork; it is freed here.
  */
 void
 enter_forked_process(struct trapframe *tf)
 {
-	(void)tf;
+	struct trapframe mytf;
+
+	/* Move the trapframe onto our own stack so it can be freed. */
+	mytf = *tf;
+	kfree(tf);
+
+	/* fork() returns 0 in the child. */
+	mytf.tf_v0 = 0;
+	mytf.tf_a3 = 0;
+	mytf.tf_epc += 4;
+
+	as_activate();
+
+	mips_usermode(&mytf);
 }
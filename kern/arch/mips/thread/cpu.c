@@ -98,6 +98,22 @@ cpu_machdep_init(struct cpu *c)
 	}
 }
 
+/*
+ * Read the cycle counter, cop0 register 9 (Count).
+ */
+uint32_t
+cpu_cycles(void)
+{
+	uint32_t count;
+
+	__asm volatile(".set push;"		/* save assembler mode */
+		       ".set mips32;"		/* allow mips32 instructions */
+		       "mfc0 %0,$9;"		/* get cop0 reg 9 (Count) */
+		       ".set pop"		/* restore assembler mode */
+		       : "=r" (count));
+	return count;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
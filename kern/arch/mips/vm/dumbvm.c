@@ -66,6 +66,14 @@
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 #endif
 
+/*
+ * Source of as_id. Zero means nothing and is never handed out. At 64
+ * bits the counter can't wrap in any realistic uptime, so an id is
+ * never reused.
+ */
+static uint64_t as_nextid = 1;
+static struct spinlock as_idlock = SPINLOCK_INITIALIZER;
+
 
 void
 vm_bootstrap(void)
@@ -156,6 +164,23 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+void
+vm_printtlbstats(void)
+{
+	const struct tlbstats *ts;
+	unsigned i, n;
+
+	kprintf("%-5s %10s %10s %8s %8s\n",
+		"cpu", "misses", "refills", "flushes", "kept");
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		ts = &cpu_get(i)->c_tlbstats;
+		kprintf("%-5u %10u %10u %8u %8u\n", i,
+			ts->tlbs_misses, ts->tlbs_refills, ts->tlbs_flushes,
+			ts->tlbs_flushskips);
+	}
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -239,6 +264,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	curcpu->c_tlbstats.tlbs_misses++;
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_read(&ehi, &elo, i);
 		if (elo & TLBLO_VALID) {
@@ -248,6 +274,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
+		curcpu->c_tlbstats.tlbs_refills++;
 		splx(spl);
 		return 0;
 	}
@@ -273,6 +300,10 @@ as_create(void)
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
 
+	spinlock_acquire(&as_idlock);
+	as->as_id = as_nextid++;
+	spinlock_release(&as_idlock);
+
 	return as;
 }
 
@@ -296,9 +327,21 @@ as_activate(void)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	/*
+	 * Mappings never change once made, so if the TLB already holds
+	 * ours it can stay. as_id is 64 bits and never reused.
+	 */
+	if (curcpu->c_tlbasid == as->as_id) {
+		curcpu->c_tlbstats.tlbs_flushskips++;
+		splx(spl);
+		return;
+	}
+
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
+	curcpu->c_tlbasid = as->as_id;
+	curcpu->c_tlbstats.tlbs_flushes++;
 
 	splx(spl);
 }
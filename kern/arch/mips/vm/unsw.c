@@ -32,6 +32,9 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -40,26 +43,74 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 
 
 
+/*
+ * The frame table has one entry per physical frame and is managed as
+ * a binary buddy allocator. A free block of 2^k frames starts at a
+ * frame number that is a multiple of 2^k; its first frame is marked
+ * free_head with order k and is linked on free_lists[k] through
+ * next/prev (frame numbers, NO_FRAME terminated). On free a block
+ * merges with its buddy (the block whose frame number differs only in
+ * bit k) for as long as that buddy is a free block of the same order.
+ *
+ * Allocated blocks are exactly as long as requested: the unused tail
+ * of the power-of-two block is freed straight back. The first frame
+ * of an allocated block records its length in npages, so free_frames
+ * knows how much to give back.
+ *
+ * User pages can be mapped by several address spaces at once after a
+ * copy-on-write fork; refcount counts those mappings (see frame_incref
+ * below) and is protected by frame_ref_spinlock, not the allocator's
+ * lock, so that fork and page faults don't contend with allocation.
+ *
+ * A user frame with a single mapping also records that mapping's
+ * address space and page in owner/vpage (also under
+ * frame_ref_spinlock), which is what the page replacement clock in
+ * frame_clocknext goes by.
+ *
+ * Single frames sitting in a per-CPU frame cache are still marked
+ * allocated, as far as the buddy allocator is concerned, so they also
+ * carry the cached flag, which is how free_frames tells a double free
+ * of one from a real free.
+ */
+
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
-        unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned free_head:1; /* the frame heads a free block */
+        unsigned order:5;     /* order of the free block this frame heads */
+        unsigned cached:1;    /* the frame is in a per-CPU frame cache */
+        uint16_t refcount;    /* mappings of a single allocated frame */
+        uint32_t npages;      /* length of the allocated block it heads */
+        uint32_t next;        /* free list links */
+        uint32_t prev;
+        struct addrspace *owner; /* user page in this frame, if known */
+        vaddr_t vpage;
 } ft_entry_t;
 
 
 static ft_entry_t * frame_table = NULL; /* base of frame table */
 static uint32_t first_frame;
 static uint32_t last_frame;
+static uint32_t clock_hand;             /* next frame for frame_clocknext */
 
 #define PAGE_BITS 12
 #define TRUE 1
 #define FALSE 0
 
+#define MAX_ORDER 10                /* largest block is 2^10 frames (4M) */
+#define NO_FRAME 0xffffffff
+
+static uint32_t free_lists[MAX_ORDER + 1];
+static uint32_t nfree;                  /* frames on the free lists */
+
+static void free_range(uint32_t f, uint32_t n);
+
 
 /* frame_table protected by spinlock (interrupt disabling on
  * uniprocessor) as this implementation does not block.
  */ 
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock frame_ref_spinlock = SPINLOCK_INITIALIZER;
 
 /*
  * Called very early in system boot to figure out how much physical
@@ -122,6 +173,10 @@ ram_bootstrap(void)
 
         /* Now initialise the frame table in two ranges. */
 
+        for (i = 0; i <= MAX_ORDER; i++) {
+                free_lists[i] = NO_FRAME;
+        }
+
         /* The first range of frames are used by the kernel already
          * and frametable itself, so mark as used.
          */
@@ -129,7 +184,10 @@ ram_bootstrap(void)
         for (i = 0; i < (firstpaddr >> PAGE_BITS); i++) {
                 /* Mark as allocated as individual pages */
                 frame_table[i].allocated = TRUE;
-                frame_table[i].not_last = FALSE;
+                frame_table[i].free_head = FALSE;
+                frame_table[i].cached = FALSE;
+                frame_table[i].npages = 1;
+                frame_table[i].owner = NULL;
         }                                            
         
         /* 
@@ -137,12 +195,15 @@ ram_bootstrap(void)
          */
         
         first_frame = firstpaddr >> PAGE_BITS;
+        clock_hand = first_frame;
         
-        for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
-                frame_table[i].allocated = FALSE;
+        for (i = first_frame; i < last_frame; i++) {
+                frame_table[i].allocated = TRUE;
+                frame_table[i].free_head = FALSE;
+                frame_table[i].cached = FALSE;
+                frame_table[i].owner = NULL;
         }
-
-        
+        free_range(first_frame, last_frame - first_frame);
 }
 
 /*
@@ -189,84 +250,267 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * Free list primitives. The caller holds frame_table_spinlock (or is
+ * ram_bootstrap, before anyone else can get at the table).
  */
 
+static void free_list_add(uint32_t f, unsigned order)
+{
+        frame_table[f].allocated = FALSE;
+        frame_table[f].free_head = TRUE;
+        frame_table[f].order = order;
+        frame_table[f].prev = NO_FRAME;
+        frame_table[f].next = free_lists[order];
+        if (free_lists[order] != NO_FRAME) {
+                frame_table[free_lists[order]].prev = f;
+        }
+        free_lists[order] = f;
+        nfree += 1U << order;
+}
 
-static paddr_t alloc_one_frame(unsigned int npages)
+static void free_list_remove(uint32_t f)
 {
-        unsigned int i;
+        ft_entry_t *fe = &frame_table[f];
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
-        KASSERT(npages == 1);
+        KASSERT(fe->free_head == TRUE);
 
-        spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
+        if (fe->prev != NO_FRAME) {
+                frame_table[fe->prev].next = fe->next;
+        }
+        else {
+                free_lists[fe->order] = fe->next;
+        }
+        if (fe->next != NO_FRAME) {
+                frame_table[fe->next].prev = fe->prev;
+        }
+        fe->free_head = FALSE;
+        nfree -= 1U << fe->order;
+}
+
+/*
+ * Free the aligned block of 2^order frames at f, merging it with its
+ * buddy as far as possible.
+ */
+static void free_block(uint32_t f, unsigned order)
+{
+        uint32_t buddy, i;
 
-                        spinlock_release(&frame_table_spinlock);
+        for (i = f; i < f + (1U << order); i++) {
+                frame_table[i].allocated = FALSE;
+                frame_table[i].cached = FALSE;
+        }
 
-                        return (paddr_t) (i << PAGE_BITS);
+        while (order < MAX_ORDER) {
+                buddy = f ^ (1U << order);
+                if (buddy < first_frame || buddy >= last_frame ||
+                    frame_table[buddy].free_head == FALSE ||
+                    frame_table[buddy].order != order) {
+                        break;
+                }
+                free_list_remove(buddy);
+                if (buddy < f) {
+                        f = buddy;
                 }
+                order++;
         }
-        
-        /* Did not find an unallocated frame :-( */
+        free_list_add(f, order);
+}
 
-        spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+/*
+ * Free an arbitrary run of frames by splitting it into the largest
+ * aligned power-of-two blocks it contains.
+ */
+static void free_range(uint32_t f, uint32_t n)
+{
+        unsigned order;
+
+        while (n > 0) {
+                order = 0;
+                while (order < MAX_ORDER &&
+                       (f & ((2U << order) - 1)) == 0 &&
+                       (2U << order) <= n) {
+                        order++;
+                }
+                free_block(f, order);
+                f += 1U << order;
+                n -= 1U << order;
+        }
 }
 
-static paddr_t alloc_multiple_frames(unsigned int npages)
+/*
+ * Take a block of at least 2^order frames off the free lists,
+ * splitting a larger one if need be. Single frames come straight off
+ * free_lists[0] in the common case, and never take more than
+ * MAX_ORDER steps.
+ */
+static uint32_t alloc_block(unsigned order)
 {
-        unsigned int i,j;
+        unsigned k;
+        uint32_t f;
 
+        for (k = order; k <= MAX_ORDER; k++) {
+                if (free_lists[k] != NO_FRAME) {
+                        break;
+                }
+        }
+        if (k > MAX_ORDER) {
+                return NO_FRAME;
+        }
 
-        /* scan from 'i' for the number of needed free frames. If an
-         * allocated frame is encountered, restart the scan from after
-         * that point.
-         */
-        
+        f = free_lists[k];
+        free_list_remove(f);
+
+        /* Give back the upper halves until the block is the right size. */
+        while (k > order) {
+                k--;
+                free_list_add(f + (1U << k), k);
+        }
+        return f;
+}
+
+static paddr_t alloc_frames(unsigned int npages)
+{
+        unsigned order;
+        uint32_t f, i;
+
+        KASSERT(npages > 0);
+
+        order = 0;
+        while ((1U << order) < npages) {
+                order++;
+        }
+        if (order > MAX_ORDER) {
+                return (paddr_t) 0;
+        }
 
         spinlock_acquire(&frame_table_spinlock);
 
-        i = first_frame; j = 0;
+        f = alloc_block(order);
+        if (f == NO_FRAME) {
+                /* Did not find a big enough free block :-( */
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
-                }
-                else {
-                        j = j + 1; /* increment count of free frames */
-                }
+        for (i = f; i < f + (1U << order); i++) {
+                frame_table[i].allocated = TRUE;
+                frame_table[i].free_head = FALSE;
         }
+        frame_table[f].npages = npages;
+        frame_table[f].refcount = 1;
+        frame_table[f].owner = NULL;
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
+        /* Hand back the tail we don't need. */
+        if (npages < (1U << order)) {
+                free_range(f + npages, (1U << order) - npages);
+        }
+
+        spinlock_release(&frame_table_spinlock);
+
+        return (paddr_t) f << PAGE_BITS;
+}
+
+/*
+ * Per-CPU frame caches (struct framecache in machine/vm.h). The
+ * caller has interrupts off, so the cache can't be touched by anyone
+ * else, and takes frame_table_spinlock only to move a batch.
+ */
+
+static void framecache_refill(struct framecache *fc)
+{
+        uint32_t f;
+
+        spinlock_acquire(&frame_table_spinlock);
+        while (fc->fc_count < FRAMECACHE_BATCH) {
+                f = alloc_block(0);
+                if (f == NO_FRAME) {
+                        break;
                 }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+                frame_table[f].allocated = TRUE;
+                frame_table[f].cached = TRUE;
+                frame_table[f].npages = 1;
+                fc->fc_frames[fc->fc_count++] = (paddr_t) f << PAGE_BITS;
+        }
+        spinlock_release(&frame_table_spinlock);
+}
 
-                spinlock_release(&frame_table_spinlock);
-                
-                return (paddr_t) (i << PAGE_BITS);
+static void framecache_drain(struct framecache *fc)
+{
+        unsigned i;
+
+        /* The oldest (coldest) frames are at the bottom. */
+        spinlock_acquire(&frame_table_spinlock);
+        for (i = 0; i < FRAMECACHE_BATCH; i++) {
+                free_block(fc->fc_frames[i] >> PAGE_BITS, 0);
         }
-        
-        /* Did not find an unallocated contiguous range of frames :-( */
+        spinlock_release(&frame_table_spinlock);
+
+        fc->fc_count -= FRAMECACHE_BATCH;
+        for (i = 0; i < fc->fc_count; i++) {
+                fc->fc_frames[i] = fc->fc_frames[i + FRAMECACHE_BATCH];
+        }
+}
+
+static paddr_t framecache_alloc(void)
+{
+        struct framecache *fc;
+        paddr_t paddr;
+        int spl;
+
+        spl = splhigh();
+        fc = &curcpu->c_framecache;
+        if (fc->fc_count == 0) {
+                framecache_refill(fc);
+        }
+        paddr = fc->fc_count > 0 ? fc->fc_frames[--fc->fc_count] : 0;
+        splx(spl);
+
+        if (paddr != 0) {
+                spinlock_acquire(&frame_ref_spinlock);
+                frame_table[paddr >> PAGE_BITS].cached = FALSE;
+                frame_table[paddr >> PAGE_BITS].refcount = 1;
+                frame_table[paddr >> PAGE_BITS].owner = NULL;
+                spinlock_release(&frame_ref_spinlock);
+        }
+
+        return paddr;
+}
 
+/*
+ * Empty this CPU's frame cache into the frame table. The page-out
+ * daemon does this after freeing a batch, since the frames are
+ * wanted by whoever is short of memory, likely on another CPU.
+ */
+void framecache_flush(void)
+{
+        struct framecache *fc;
+        unsigned i;
+        int spl;
+
+        spl = splhigh();
+        fc = &curcpu->c_framecache;
+        spinlock_acquire(&frame_table_spinlock);
+        for (i = 0; i < fc->fc_count; i++) {
+                free_block(fc->fc_frames[i] >> PAGE_BITS, 0);
+        }
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+        fc->fc_count = 0;
+        splx(spl);
+}
+
+static void framecache_free(paddr_t paddr)
+{
+        struct framecache *fc;
+        int spl;
+
+        spl = splhigh();
+        fc = &curcpu->c_framecache;
+        if (fc->fc_count == FRAMECACHE_SIZE) {
+                framecache_drain(fc);
+        }
+        frame_table[paddr >> PAGE_BITS].cached = TRUE;
+        fc->fc_frames[fc->fc_count++] = paddr;
+        splx(spl);
 }
 
 static void free_frames(vaddr_t vaddr)
@@ -280,18 +524,26 @@ static void free_frames(vaddr_t vaddr)
 
         i = paddr >> PAGE_BITS;
 
-        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(i >= first_frame && i < last_frame);
 
-        if (frame_table[i].allocated == FALSE) { /* check for double free error */
+        /*
+         * The block is ours until it is freed, so its head entry can
+         * be looked at without the lock.
+         */
+        /* check for double free error */
+        if (frame_table[i].allocated == FALSE || frame_table[i].cached == TRUE) {
                 panic("Double free error!!");
         }
-        
-        while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
-                frame_table[i].allocated = FALSE;
-                if (frame_table[i].not_last == TRUE) {
-                        i++;
-                }
+
+        if (frame_table[i].npages == 1 && CURCPU_EXISTS()) {
+                framecache_free(paddr);
+                return;
         }
+
+        spinlock_acquire(&frame_table_spinlock);
+
+        free_range(i, frame_table[i].npages);
+
         spinlock_release(&frame_table_spinlock);
 }
         
@@ -300,11 +552,13 @@ vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
+
+        /* Before thread_bootstrap there is no curcpu to cache on. */
+        if (npages == 1 && CURCPU_EXISTS()) {
+                paddr = framecache_alloc();
         }
         else {
-                paddr = alloc_one_frame(npages);
+                paddr = alloc_frames(npages);
         }
         
 	if (paddr == 0) {
@@ -319,3 +573,150 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Allocate an aligned run of 2^order frames for user pages. Each frame
+ * is set up as a block of its own, with one reference and no owner,
+ * so the pages can be mapped, paged out and freed one at a time; the
+ * buddy merge puts the run back together once they have all gone.
+ */
+paddr_t
+frame_allocrun(unsigned order)
+{
+        uint32_t f, i;
+
+        if (order > MAX_ORDER) {
+                return (paddr_t) 0;
+        }
+
+        spinlock_acquire(&frame_table_spinlock);
+
+        f = alloc_block(order);
+        if (f == NO_FRAME) {
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
+
+        for (i = f; i < f + (1U << order); i++) {
+                frame_table[i].allocated = TRUE;
+                frame_table[i].free_head = FALSE;
+                frame_table[i].npages = 1;
+                frame_table[i].refcount = 1;
+                frame_table[i].owner = NULL;
+        }
+
+        spinlock_release(&frame_table_spinlock);
+
+        return (paddr_t) f << PAGE_BITS;
+}
+
+/*
+ * Reference counts on single user frames, for copy-on-write. A frame
+ * starts with one reference when allocated; frame_decref frees it when
+ * the last one goes away.
+ */
+void
+frame_incref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_ref_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount > 0 && frame_table[i].refcount < 0xffff);
+        frame_table[i].refcount++;
+        spinlock_release(&frame_ref_spinlock);
+}
+
+void
+frame_decref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        unsigned refcount;
+
+        spinlock_acquire(&frame_ref_spinlock);
+        KASSERT(frame_table[i].refcount > 0);
+        refcount = --frame_table[i].refcount;
+        if (refcount == 0) {
+                frame_table[i].owner = NULL;
+        }
+        spinlock_release(&frame_ref_spinlock);
+
+        if (refcount == 0) {
+                free_kpages(PADDR_TO_KVADDR(paddr));
+        }
+}
+
+unsigned
+frame_refcount(paddr_t paddr)
+{
+        return frame_table[paddr >> PAGE_BITS].refcount;
+}
+
+/*
+ * Number of free frames, including the ones sitting in per-CPU
+ * caches: on a small machine with several CPUs those can be a good
+ * part of the pager's watermarks. It is read without any locks, so is
+ * only a snapshot.
+ */
+unsigned
+frame_freecount(void)
+{
+        unsigned i, n;
+
+        n = nfree;
+        for (i = 0; i < cpu_count(); i++) {
+                n += cpu_get(i)->c_framecache.fc_count;
+        }
+        return n;
+}
+
+void
+frame_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vpage)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_ref_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].owner = as;
+        frame_table[i].vpage = vpage;
+        spinlock_release(&frame_ref_spinlock);
+}
+
+void
+frame_disown(paddr_t paddr, struct addrspace *as)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_ref_spinlock);
+        if (frame_table[i].owner == as) {
+                frame_table[i].owner = NULL;
+        }
+        spinlock_release(&frame_ref_spinlock);
+}
+
+/*
+ * The page replacement clock. Frames that are free, belong to the
+ * kernel or the page cache, or are shared copy-on-write have no
+ * owner (or more than one reference) and are passed over. The owner
+ * is only a hint: the caller must check that the page table still
+ * agrees before doing anything with the frame.
+ */
+paddr_t
+frame_clocknext(struct addrspace **as, vaddr_t *vpage)
+{
+        ft_entry_t *fe;
+        paddr_t paddr = 0;
+
+        spinlock_acquire(&frame_ref_spinlock);
+        fe = &frame_table[clock_hand];
+        if (fe->allocated == TRUE && fe->refcount == 1 && fe->owner != NULL) {
+                *as = fe->owner;
+                *vpage = fe->vpage;
+                paddr = (paddr_t) clock_hand << PAGE_BITS;
+        }
+        if (++clock_hand == last_frame) {
+                clock_hand = first_frame;
+        }
+        spinlock_release(&frame_ref_spinlock);
+
+        return paddr;
+}
@@ -42,6 +42,7 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <kmemcache.h>
 #include "sfsprivate.h"
 
 
@@ -329,6 +330,16 @@ sfs_fs_create(void)
 	COMPILE_ASSERT(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
 
+	/* Make the vnode cache on the first mount (we hold vfs_biglock) */
+	if (sfs_vnode_cache == NULL) {
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    NULL, NULL);
+		if (sfs_vnode_cache == NULL) {
+			goto fail;
+		}
+	}
+
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
@@ -39,6 +39,8 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct hpt_entry;
 
 
 /*
@@ -48,6 +50,45 @@ struct vnode;
  * You write this.
  */
 
+#if !OPT_DUMBVM
+/*
+ * A region is a page-aligned run of virtual memory with one set of
+ * permissions. An address space has any number of them on a list.
+ * Regions may overlap (ELF segments sometimes share a page); a page's
+ * permissions are the union of those of every region containing it.
+ *
+ * A region may be backed by a file: its pages are then filled on
+ * first touch with the rg_filesz bytes at file offset rg_offset,
+ * which belong at rg_fvaddr; anything else in the region is zero.
+ *
+ * Regions made by mmap are marked RGF_MMAP, and never overlap anything.
+ * Their file pages come from the page cache: a MAP_SHARED region
+ * (RGF_SHARED) maps the cached frames themselves and writes them back
+ * to the file, while a private one maps them copy-on-write. Anonymous
+ * mmap regions have no file; shared ones keep their frames across
+ * fork instead of copying them.
+ */
+struct region {
+        vaddr_t rg_vbase;               /* first page of the region */
+        size_t rg_npages;               /* length in pages */
+        int rg_perms;                   /* RG_* below */
+        struct vnode *rg_vnode;         /* backing file, or NULL */
+        off_t rg_offset;                /* file offset of the data */
+        vaddr_t rg_fvaddr;              /* where the data goes */
+        size_t rg_filesz;               /* how much of it there is */
+        int rg_flags;                   /* RGF_* below */
+        struct region *rg_next;
+};
+
+#define RG_X    0x1     /* executable */
+#define RG_W    0x2     /* writable */
+#define RG_R    0x4     /* readable */
+
+#define RGF_MMAP        0x1     /* made by mmap; munmap may remove it */
+#define RGF_SHARED      0x2     /* MAP_SHARED: writes go to the file */
+#define RGF_SEQUENTIAL  0x4     /* MADV_SEQUENTIAL: fault ahead */
+#endif
+
 struct addrspace {
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
@@ -58,8 +99,16 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region *as_regions;      /* list of regions */
+        struct hpt_entry *as_ptes;      /* our page table entries */
+        struct lock *as_lock;           /* protects regions and page table */
+        bool as_loading;                /* between prepare and complete load */
+        struct region *as_heap;         /* sbrk region, once loaded */
+        vaddr_t as_heapend;             /* the break */
+        struct cpu *as_lastcpu;         /* where we last ran; as_activate */
+        unsigned as_npaging;            /* pages in the pager's batch */
 #endif
+        uint64_t as_id;                 /* never reused; as_activate */
 };
 
 /*
@@ -118,6 +167,110 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+/*
+ * as_perms - return the RG_* permissions of the page containing
+ *            VADDR, or 0 if it is not in any region. The caller must
+ *            hold as_lock.
+ */
+int               as_perms(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * as_define_file_region - as_define_region, but the segment's first
+ *            FILESIZE bytes come from file V at OFFSET, read in as
+ *            pages are touched. Takes a reference to V.
+ *
+ * as_fill_page - copy into the page at kernel address KPAGE whatever
+ *            file data belongs in user page VPAGE. The page must be
+ *            zeroed already. The caller must hold as_lock.
+ *
+ * as_text_page - if user page VPAGE is read-only and wholly the
+ *            contents of one page of a file, so that it can be shared
+ *            with anyone else mapping that page, return true and the
+ *            file and page-aligned offset in *V and *OFFSET. The
+ *            caller must hold as_lock.
+ */
+int               as_define_file_region(struct addrspace *as,
+                                        vaddr_t vaddr, size_t memsize,
+                                        int readable,
+                                        int writeable,
+                                        int executable,
+                                        struct vnode *v, off_t offset,
+                                        size_t filesize);
+int               as_fill_page(struct addrspace *as, vaddr_t vpage,
+                               vaddr_t kpage);
+bool              as_text_page(struct addrspace *as, vaddr_t vpage,
+                               struct vnode **v, off_t *offset);
+
+/*
+ * as_sbrk - move the break by AMOUNT bytes and return the old one in
+ *            *OLDBREAK. The heap region starts out empty at the first
+ *            page past the executable's segments (as_complete_load
+ *            puts it there). Growing only extends the region; pages
+ *            get frames when touched. Shrinking frees the pages that
+ *            fall off the end at once.
+ */
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+
+/*
+ * as_mmap   - map NPAGES pages of file V, from page-aligned OFFSET on,
+ *            with RG_* permissions PERMS, and return the address
+ *            chosen in *RET. HINT is used if those pages are free;
+ *            otherwise the highest free run below the stack is. If
+ *            SHARED, writes go to the file. Takes a reference to V.
+ *            If V is NULL the memory is anonymous.
+ *
+ * as_munmap - remove whatever parts of mmap'd regions lie in the
+ *            NPAGES pages at VADDR, writing shared pages back to the
+ *            file first. Other regions are left alone.
+ *
+ * as_msync  - write the shared pages in the NPAGES pages at VADDR
+ *            that have been changed back to the file.
+ *
+ * as_madvise - act on MADV_* ADVICE for the NPAGES pages at VADDR.
+ *            MADV_WILLNEED pages them in now and MADV_DONTNEED frees
+ *            them (shared file pages are written back first); the
+ *            others set or clear fault-ahead on every region touched.
+ *
+ * as_mincore - set VEC[i] to 1 if page i of the NPAGES at VADDR is
+ *            resident, else 0. Fails with ENOMEM if any page is in
+ *            no region.
+ *
+ * as_mapped_page - if user page VPAGE is in an mmap'd region of a
+ *            file, or a shared one, return true, the file (or NULL)
+ *            and page offset in *V and *OFFSET, and in *SHARED
+ *            whether the mapping is shared. The caller must hold
+ *            as_lock.
+ *
+ * as_faultahead - return the end of the pages to bring in along with
+ *            VPAGE when it faults: VPAGE + PAGE_SIZE, unless its
+ *            region was advised MADV_SEQUENTIAL. The caller must hold
+ *            as_lock.
+ *
+ * as_cluster - return true if the VM_CLUSTER pages around VPAGE all
+ *            lie in one writable private region of at least
+ *            VM_CLUSTERMIN pages, and in no other, so that they can
+ *            be given frames together. The caller must hold as_lock.
+ */
+int               as_mmap(struct addrspace *as, vaddr_t hint, size_t npages,
+                          int perms, bool shared,
+                          struct vnode *v, off_t offset, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr,
+                            size_t npages);
+int               as_msync(struct addrspace *as, vaddr_t vaddr,
+                           size_t npages);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr,
+                             size_t npages, int advice);
+int               as_mincore(struct addrspace *as, vaddr_t vaddr,
+                             size_t npages, unsigned char *vec);
+bool              as_mapped_page(struct addrspace *as, vaddr_t vpage,
+                                 struct vnode **v, off_t *offset,
+                                 bool *shared);
+vaddr_t           as_faultahead(struct addrspace *as, vaddr_t vpage);
+bool              as_cluster(struct addrspace *as, vaddr_t vpage);
+#endif
+
 
 /*
  * Functions in loadelf.c
@@ -33,9 +33,21 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
-#include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX, struct framecache */
+#include <syscall.h>     /* for SYSCALL_MAX, struct syscall_stat */
 
 
+/*
+ * Per-cpu magazines of free kmalloc blocks, one per subpage block
+ * size, chained through the blocks' first words. See kmalloc.c.
+ */
+#define KMCACHE_NSIZES 8
+
+struct kmcache {
+	void *kc_blocks[KMCACHE_NSIZES];
+	unsigned kc_count[KMCACHE_NSIZES];
+};
+
 /*
  * Per-cpu structure
  *
@@ -61,6 +73,12 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct syscall_stat c_syscallstats[SYSCALL_MAX]; /* Syscall counters */
+	struct framecache c_framecache;	/* Free frames (see machine/vm.h) */
+	struct kmcache c_kmcache;	/* Free kmalloc blocks (see above) */
+	uint64_t c_tlbasid;		/* as_id of what's in the TLB, or 0 */
+	unsigned c_tlbfree;		/* TLB slots below this are in use */
+	struct tlbstats c_tlbstats;	/* TLB counters (see machine/vm.h) */
 
 	/*
 	 * Accessed by other cpus.
@@ -112,6 +130,20 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Enumerate the CPUs, e.g. to sum per-cpu statistics. cpu_get takes
+ * a software cpu number (c_number) less than cpu_count().
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+
+/*
+ * Read the current CPU's free-running cycle counter. It wraps, and
+ * counters of different CPUs are unrelated, so only differences
+ * taken on one CPU are meaningful.
+ */
+uint32_t cpu_cycles(void);
+
 /*
  * Produce a string describing the CPU type.
  */
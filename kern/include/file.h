@@ -10,6 +10,7 @@
  */
 
 #include <limits.h>
+#include <spinlock.h>
 
 #define MAX_PROCESS 128
 #define NUM_SYSCALLS 7
@@ -21,31 +22,62 @@
 #define DUP2 5
 #define FORK 6
 
+/* number of 32-bit words in the fd table's in-use bitmap */
+#define FDT_WORDS ((OPEN_MAX + 31) / 32)
+
 /*
  * Put your function declarations and data types here ...
  */
 
-// open file table entry
+/*
+ * Open file table entry. Entries come from the open file table's object
+ * cache in file.c and go back to it on last close; ref_lock and
+ * offset_lock are set up by the cache's constructor and kept across
+ * reuse.
+ *
+ * ref_count counts every fd slot (in any process) and every in-flight
+ * syscall using the entry, and is protected by ref_lock. offset_lock
+ * is a sleep lock held across the VOP call of any I/O that uses or
+ * updates file_offset.
+ */
 typedef struct open_file {
     struct vnode *v_ptr;
     off_t file_offset;
     int flags; // read or write permissions
     int ref_count;
+    struct spinlock ref_lock; // protects ref_count
+    struct lock *offset_lock; // protects file_offset
 } of_entry;
 
-// file descriptor entry 
-typedef struct fd_entry {
-    of_entry *process_fd_array[MAX_PROCESS];
-    int cur_index;
-} fd_entry;
+/*
+ * Per process file descriptor table. fdt_inuse has one bit per slot
+ * of fdt_files, set when the slot is occupied, so the lowest free fd
+ * can be found a word at a time instead of probing every slot.
+ *
+ * fdt_lock is a spinlock: it is only ever held for a few loads and
+ * stores, never across vfs calls, so opens, closes and dup2s on
+ * different fds of one process only contend for those few cycles.
+ */
+typedef struct fd_table {
+    struct spinlock fdt_lock;
+    uint32_t fdt_inuse[FDT_WORDS];
+    of_entry *fdt_files[OPEN_MAX];
+} fd_table;
 
 /* HELPER FUNCTIONS */
-fd_entry *initialize_fd_table(void);
+void of_bootstrap(void);
 of_entry *create_open_file(void);
 int free_open_file(of_entry *open_file);
+void of_incref(of_entry *ofptr);
+void of_decref(of_entry *ofptr);
 
-// of_table *create_of_table(void);
-int add_to_of_table(of_entry *ofptr);
-int add_to_fd_table(int process, fd_entry *process_fd_table, of_entry *ofptr);
+/* FD TABLE FUNCTIONS */
+fd_table *fd_table_create(void);
+fd_table *fd_table_copy(fd_table *src);
+void fd_table_destroy(fd_table *fdt);
+int fd_alloc(fd_table *fdt, of_entry *ofptr, int *fd);
+int fd_replace(fd_table *fdt, int fd, of_entry *ofptr, of_entry **old);
+int fd_remove(fd_table *fdt, int fd, of_entry **old);
+of_entry *fd_get(fd_table *fdt, int fd);
 
 #endif /* _FILE_H_ */
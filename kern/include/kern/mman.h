@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap(), munmap(), msync() and madvise(), for libc's
+ * <sys/mman.h>.
+ */
+
+/* Protection for mmap: none, or any of the others */
+#define PROT_NONE     0      /* Pages may not be accessed */
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+/* Flags for mmap: choose one of these: */
+#define MAP_SHARED    1      /* Writes go to the file and other mappers */
+#define MAP_PRIVATE   2      /* Writes go to a private copy */
+/* then or in any of these: */
+#define MAP_ANONYMOUS 16     /* Zero-filled memory, not a file; fd ignored */
+#define MAP_POPULATE  32     /* Fault everything in now */
+#define MAP_ANON      MAP_ANONYMOUS
+
+/* Flags for msync: choose one of these: */
+#define MS_ASYNC      1      /* Schedule writes (done at once in OS/161) */
+#define MS_SYNC       2      /* Write and wait */
+/* then or in this if you like: */
+#define MS_INVALIDATE 4      /* Required by POSIX; does nothing here */
+
+/* Advice for madvise */
+#define MADV_NORMAL     0    /* No special treatment */
+#define MADV_RANDOM     1    /* Expect random access: no fault-ahead */
+#define MADV_SEQUENTIAL 2    /* Expect sequential access: fault ahead */
+#define MADV_WILLNEED   3    /* Fault the pages in now */
+#define MADV_DONTNEED   4    /* Free the pages; they refill when touched */
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -73,7 +73,14 @@ struct proc {
 
 	/* add more material here as needed */
 
-	of_entry *file_table[OPEN_MAX]; /* array of open file entries */
+	fd_table *file_table;		/* file descriptor table */
+
+	/* Process table; protected by the table's lock in proc.c */
+	pid_t p_pid;			/* 0 if not in the table */
+	pid_t p_ppid;			/* parent's pid, 0 if none */
+	bool p_exited;			/* zombie waiting to be reaped */
+	int p_exitstatus;		/* waitpid status once exited */
+	bool p_vforked;			/* running on the parent's addrspace */
 
 };
 
@@ -86,9 +93,24 @@ void proc_bootstrap(void);
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
+/* Create a child of the current process for fork() or vfork(). */
+int proc_fork(struct proc **ret, bool vfork);
+
+/* vfork: wait for CHILD to give back our address space. */
+void proc_vfork_wait(struct proc *child);
+
+/* vfork child: give the borrowed address space back to the parent. */
+void proc_vfork_release(void);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/* Exit the current process with waitpid status EXITSTATUS. */
+__DEAD void proc_exit(int exitstatus);
+
+/* Wait for child PID of the current process to exit and reap it. */
+int proc_wait(pid_t pid, int options, int *exitstatus, pid_t *retval);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -37,6 +37,19 @@
 
 #include <spinlock.h>
 
+/*
+ * Semaphores, locks and CVs come from object caches (see
+ * <kmemcache.h>) and are recycled with their wait channels and
+ * spinlocks already set up. Names are copied into the objects,
+ * cut short at SYNCH_NAMELEN - 1 characters.
+ *
+ * synch_bootstrap sets up the caches. It must be called before any
+ * of these are created.
+ */
+#define SYNCH_NAMELEN 32
+
+void synch_bootstrap(void);
+
 /*
  * Dijkstra-style semaphore.
  *
@@ -44,7 +57,7 @@
  * internally.
  */
 struct semaphore {
-        char *sem_name;
+        char sem_name[SYNCH_NAMELEN];
         struct wchan *sem_wchan;
         struct spinlock sem_lock;
         volatile unsigned sem_count;
@@ -73,7 +86,7 @@ void V(struct semaphore *);
  * (should be) made internally.
  */
 struct lock {
-        char *lk_name;
+        char lk_name[SYNCH_NAMELEN];
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
@@ -91,12 +104,15 @@ void lock_destroy(struct lock *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
+ *    lock_tryacquire - Get the lock if nobody holds it and return true;
+ *                   otherwise return false at once instead of waiting.
  *
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+bool lock_tryacquire(struct lock *);
 
 
 /*
@@ -114,7 +130,7 @@ bool lock_do_i_hold(struct lock *);
  */
 
 struct cv {
-        char *cv_name;
+        char cv_name[SYNCH_NAMELEN];
         struct wchan *cv_wchan;
         struct spinlock cv_wchanlock;
 };
@@ -32,14 +32,32 @@
 
 
 #include <cdefs.h> /* for __DEAD */
+#include <kern/syscallstat.h>
 struct trapframe; /* from <machine/trapframe.h> */
 
+/*
+ * Size of the syscall dispatch table: one more than the highest
+ * syscall number in <kern/syscall.h>.
+ */
+#define SYSCALL_MAX 123
+
 /*
  * The system call dispatcher.
  */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * Per-syscall counters, kept per CPU in struct cpu and summed over all
+ * CPUs on request.
+ *
+ * syscall_getstat	fetch the counters for one syscall number.
+ * syscall_printstats	dump the counters of every syscall that has
+ *			been called (kernel menu "sc").
+ */
+int syscall_getstat(int callno, struct syscall_stat *ret);
+void syscall_printstats(void);
+
 /*
  * Support functions.
  */
@@ -58,14 +76,38 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys___syscallstat(int callno, userptr_t user_stat);
 
 // System call implementation prototypes for assignment
-int32_t sys_open(userptr_t filename, int flags, mode_t mode);
-int32_t sys_close(int fd);
-ssize_t sys_read(int fd, void *buf, size_t buflen);
-ssize_t sys_write(int fd, const void *buf, size_t nbytes);
-off_t sys_lseek(int fd, off_t pos, int whence);
-int32_t sys_dup2(int oldfd, int newfd);
+int sys_open(userptr_t filename, int flags, mode_t mode, int32_t *retval);
+int sys_close(int fd);
+int sys_read(int fd, userptr_t buf, size_t buflen, int32_t *retval);
+int sys_write(int fd, userptr_t buf, size_t nbytes, int32_t *retval);
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos,
+	      int32_t *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t pos,
+	       int32_t *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int32_t *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int32_t *retval);
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int32_t *retval);
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos,
+		int32_t *retval);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_dup2(int oldfd, int newfd, int32_t *retval);
+
+int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys_execv(userptr_t program, userptr_t args);
+int sys_getpid(pid_t *retval);
+int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+__DEAD void sys__exit(int code);
+int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_mincore(userptr_t addr, size_t len, userptr_t vec);
 int run_stdio(void);
 
 #endif /* _SYSCALL_H_ */
@@ -55,6 +55,9 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Thread names are cut short at THREAD_NAMELEN - 1 characters */
+#define THREAD_NAMELEN 32
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -70,7 +73,7 @@ struct thread {
 	 * These go up front so they're easy to get to even if the
 	 * debugger is messed up.
 	 */
-	char *t_name;			/* Name of this thread */
+	char t_name[THREAD_NAMELEN];	/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
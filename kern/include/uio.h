@@ -138,5 +138,27 @@ int uiomovezeros(size_t len, struct uio *uio);
 void uio_kinit(struct iovec *, struct uio *,
 	       void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Initialize a uio for I/O to or from user memory described by an
+ * array of iovecs, e.g. as passed to readv/writev. The iovec array
+ * itself must already be in kernel memory (copied in) and must stay
+ * valid for as long as the uio is used; the buffers it points to are
+ * user pointers in address space AS. Returns EINVAL if the total
+ * length does not fit in a ssize_t.
+ *
+ * Usage example;
+ *	struct iovec iov[IOV_MAX];
+ *	struct uio myuio;
+ *
+ *	result = copyin(useriov, iov, iovcnt * sizeof(iov[0]));
+ *	...
+ *	result = uio_uinit(iov, iovcnt, &myuio, pos, UIO_WRITE,
+ *			   proc_getas());
+ *	...
+ *	result = VOP_WRITE(vn, &myuio);
+ */
+int uio_uinit(struct iovec *, unsigned iovcnt, struct uio *,
+	      off_t pos, enum uio_rw rw, struct addrspace *as);
+
 
 #endif /* _UIO_H_ */
@@ -55,8 +55,216 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Allocate 2^ORDER frames aligned to their size, each a separate
+ * page to be freed on its own. Returns the first frame, or 0.
+ */
+paddr_t frame_allocrun(unsigned order);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Print the per-CPU TLB counters (struct tlbstats), for the menu */
+void vm_printtlbstats(void);
+
+/*
+ * Reference counts on user page frames shared copy-on-write, kept in
+ * the frame table. A frame from alloc_kpages(1) starts with one;
+ * frame_decref frees it when the count drops to zero.
+ */
+void frame_incref(paddr_t paddr);
+void frame_decref(paddr_t paddr);
+unsigned frame_refcount(paddr_t paddr);
+
+struct addrspace;
+
+/*
+ * Reverse map for page replacement, also in the frame table.
+ *
+ *    frame_setowner - record that user page VPAGE of AS is in the
+ *                frame at PADDR (AS NULL: no single owner).
+ *    frame_disown - forget the owner of PADDR if it is AS.
+ *    frame_clocknext - advance the replacement clock hand one frame;
+ *                if that frame has one mapping and a recorded owner,
+ *                return it and the owner, else return 0.
+ *    framecache_flush - give this CPU's cached free frames back to
+ *                the frame table, so other CPUs can have them.
+ *    frame_freecount - number of free frames, in the frame table or
+ *                in per-CPU frame caches.
+ */
+void frame_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vpage);
+void frame_disown(paddr_t paddr, struct addrspace *as);
+paddr_t frame_clocknext(struct addrspace **as, vaddr_t *vpage);
+void framecache_flush(void);
+unsigned frame_freecount(void);
+
+
+/*
+ * Page table entries (not used by dumbvm).
+ *
+ * A PTE is laid out like the TLB EntryLo word: the physical frame is
+ * in the PAGE_FRAME bits, so the fault handler can build the TLB entry
+ * from it directly. The low bits are software flags.
+ */
+typedef uint32_t pte_t;
+
+#define PTE_FRAME       PAGE_FRAME  /* physical frame number */
+#define PTE_VALID       0x001       /* a frame is mapped */
+#define PTE_WRITE       0x002       /* writes allowed (TLB entry dirty) */
+#define PTE_COW         0x004       /* writable but shared: copy first */
+#define PTE_REF         0x008       /* used since the clock hand passed */
+#define PTE_SWAPPED     0x010       /* paged out: PTE_FRAME is a swap slot */
+#define PTE_BUSY        0x020       /* page-out in progress; swap_wait */
+#define PTE_DIRTY       0x040       /* written since saved to swap or file */
+#define PTE_SHARED      0x080       /* MAP_SHARED file page; never swapped */
+
+#define PTE_SLOT(pte)   ((pte) >> 12)
+#define SLOT_PTE(slot)  (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+/* Size of the user stack region, in pages */
+#define VM_STACKPAGES   1024
+
+/* Pages brought in after a fault in a MADV_SEQUENTIAL region */
+#define VM_FAULTAHEAD   8
+
+/*
+ * Pages are clustered in aligned groups of VM_CLUSTER (2^VM_CLUSTERORDER).
+ * The first touch of a cluster in a big enough private region gets
+ * frames for all of it at once, from one aligned run; and a TLB miss
+ * also loads the resident neighbours in its cluster, while the TLB
+ * has empty slots for them. The MIPS TLB only has 4K pages, so this
+ * is as close to large pages as it gets.
+ */
+#define VM_CLUSTERORDER 2
+#define VM_CLUSTER      (1 << VM_CLUSTERORDER)
+#define VM_CLUSTERMIN   16          /* smallest region to cluster, pages */
+
+/*
+ * TLB helpers, in vm.c. vm_tlbload puts a translation in an empty
+ * slot if there is one, else a random one. vm_tlbprefetch only uses
+ * an empty slot, and returns false if there are none left.
+ * vm_tlbinvalidate removes VPAGE (or with TLBSHOOTDOWN_ALL,
+ * everything) from the TLB of every CPU and waits until that is done.
+ */
+void vm_tlbflush(void);
+void vm_tlbload(vaddr_t vpage, uint32_t elo);
+bool vm_tlbprefetch(vaddr_t vpage, uint32_t elo);
+void vm_tlbinvalidate(vaddr_t vpage);
+
+/*
+ * Allocate a page for user memory, reclaiming unmapped cached pages
+ * if memory is short. Returns its kernel address, or 0. In vm.c.
+ */
+vaddr_t vm_allocpage(void);
+
+/*
+ * Page in whatever of [START, END) in AS isn't resident, as read
+ * faults would but without loading the TLB, and stop early if memory
+ * runs short. For MAP_POPULATE and fault-ahead. The caller holds
+ * as_lock. In vm.c.
+ */
+void vm_prefault(struct addrspace *as, vaddr_t start, vaddr_t end);
+
+struct vnode;
+
+/*
+ * Shared page cache for executable text and mmap'd files, in
+ * pagecache.c.
+ *
+ *    pagecache_get - find or read in the page of V at file OFFSET
+ *                (page aligned) and return its frame, with a
+ *                reference for the caller to drop with frame_decref.
+ *                Past the end of the file the page is zero.
+ *    pagecache_update - after V has been written in [START, END),
+ *                reread that part of any cached pages it touches.
+ *    pagecache_truncate - after V has been truncated to SIZE, drop
+ *                its cached pages past the end, or if they are mapped
+ *                zero them from SIZE onward.
+ *    pagecache_purge - drop every cached page of V nobody has
+ *                mapped, and with them the cache's references to V.
+ *    pagecache_reclaim - drop every cached page nobody has mapped;
+ *                returns how many frames were freed.
+ */
+int pagecache_get(struct vnode *v, off_t offset, paddr_t *ret);
+void pagecache_update(struct vnode *v, off_t start, off_t end);
+void pagecache_truncate(struct vnode *v, off_t size);
+void pagecache_purge(struct vnode *v);
+unsigned pagecache_reclaim(void);
+
+/*
+ * Paging to swap, in swap.c. Swap is the raw disk SWAP_DEVICE; if it
+ * isn't there the system runs without.
+ *
+ *    swap_bootstrap - attach swap and start the pager thread.
+ *    swap_in - read SLOT into the page at KPAGE. The slot's
+ *                reference passes to the frame, as its clean copy.
+ *    swap_dropcopy - forget the swap copy of the frame at PADDR, if
+ *                any. Called when the page is first written (PTE_DIRTY
+ *                set), shared, or freed.
+ *    swap_share/swap_free - add/drop a reference to SLOT, as
+ *                fork and exit copy and free swapped-out PTEs.
+ *    swap_pause/swap_resume - wait for any page-out of AS's pages
+ *                to finish and hold off further page-out, so that the
+ *                PTEs of AS can be copied or freed with none of them
+ *                PTE_BUSY. Call swap_pause before taking as_lock.
+ *    swap_wait - wait for the page-out of AS's pages to finish.
+ *                Called (without as_lock) on finding a PTE_BUSY page.
+ *    swap_reclaim - have the pager free some memory, paging out
+ *                dirty pages if need be, and wait for it. Returns
+ *                false if nothing could be freed. Must be called
+ *                without as_lock held.
+ *    swap_kick - wake the pager if free memory is below the low
+ *                watermark. Never blocks.
+ *    swap_printstats - print paging statistics (the "vm" menu
+ *                command).
+ */
+void swap_bootstrap(void);
+int swap_in(unsigned slot, vaddr_t kpage);
+void swap_dropcopy(paddr_t paddr);
+void swap_share(unsigned slot);
+void swap_free(unsigned slot);
+void swap_pause(struct addrspace *as);
+void swap_resume(void);
+void swap_wait(struct addrspace *as);
+bool swap_reclaim(void);
+void swap_kick(void);
+void swap_printstats(void);
+
+/*
+ * Page table operations, in pagetable.c. Except for pt_bootstrap,
+ * pt_refill and pt_prefetch, all of them expect the caller to hold the address
+ * space's as_lock.
+ *
+ *    pt_bootstrap - size and allocate the global page table.
+ *    pt_init/pt_cleanup - set up and tear down the page table of AS.
+ *    pt_lookup - return the PTE for the page containing VADDR, or
+ *                NULL if there isn't one.
+ *    pt_insert - return the PTE for VADDR, creating an empty
+ *                (zero) one if needed; NULL on out of memory.
+ *    pt_foreach - call FUNC on every non-empty PTE in AS, in no
+ *                particular order. If FUNC returns nonzero the walk
+ *                stops and that value is returned.
+ *    pt_update - store NEWPTE into PTE (the entry for VPAGE in AS).
+ *                Any change that takes access away must be made this
+ *                way, followed by a TLB flush, to be safe against a
+ *                concurrent pt_refill.
+ *    pt_refill - TLB miss fast path. Load the translation for VPAGE
+ *                from the page table if it is resident and permits
+ *                the access, and return true; return false if the
+ *                fault needs the full vm_fault treatment.
+ *    pt_prefetch - after a miss on VPAGE, load the other resident
+ *                pages of its cluster into empty TLB slots.
+ */
+void pt_bootstrap(void);
+int pt_init(struct addrspace *as);
+void pt_cleanup(struct addrspace *as);
+pte_t *pt_lookup(struct addrspace *as, vaddr_t vaddr);
+pte_t *pt_insert(struct addrspace *as, vaddr_t vaddr);
+int pt_foreach(struct addrspace *as,
+	       int (*func)(vaddr_t vpage, pte_t *pte, void *arg), void *arg);
+void pt_update(struct addrspace *as, vaddr_t vpage, pte_t *pte, pte_t newpte);
+bool pt_refill(struct addrspace *as, vaddr_t vpage, bool write);
+void pt_prefetch(struct addrspace *as, vaddr_t vpage);
+
 
 #endif /* _VM_H_ */
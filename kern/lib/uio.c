@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -162,3 +163,35 @@ uio_kinit(struct iovec *iov, struct uio *u,
 	u->uio_rw = rw;
 	u->uio_space = NULL;
 }
+
+/*
+ * Initialize a multi-segment uio over user buffers. The total must be
+ * reportable as a (32-bit) ssize_t byte count.
+ */
+
+#define UIO_MAXTOTAL ((size_t)0x7fffffff)
+
+int
+uio_uinit(struct iovec *iov, unsigned iovcnt, struct uio *u,
+	  off_t pos, enum uio_rw rw, struct addrspace *as)
+{
+	size_t total, i;
+
+	total = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (iov[i].iov_len > UIO_MAXTOTAL - total) {
+			return EINVAL;
+		}
+		total += iov[i].iov_len;
+	}
+
+	u->uio_iov = iov;
+	u->uio_iovcnt = iovcnt;
+	u->uio_offset = pos;
+	u->uio_resid = total;
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = as;
+
+	return 0;
+}
@@ -43,7 +43,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <limits.h>
 #include <spl.h>
+#include <synch.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
@@ -58,6 +63,74 @@
  */
 struct proc *kproc;
 
+/*
+ * The process table. A process with pid P lives in slot
+ * P % MAX_PROCESS; pids are handed out in increasing order (wrapping
+ * at PID_MAX), skipping those whose slot is taken, so a pid isn't
+ * reused until the allocator has been all the way round.
+ *
+ * A process stays in the table after it exits, as a zombie holding
+ * its exit status, until its parent reaps it with waitpid or exits
+ * itself. proc_table_cv is broadcast whenever a process exits.
+ */
+static struct proc *proc_table[MAX_PROCESS];
+static pid_t proc_nextpid = PID_MIN;
+static struct lock *proc_table_lock;
+static struct cv *proc_table_cv;
+
+/*
+ * Give PROC a pid. Call with proc_table_lock held.
+ */
+static
+int
+pid_alloc(struct proc *proc)
+{
+	unsigned tries;
+	pid_t pid;
+
+	for (tries = 0; tries < MAX_PROCESS; tries++) {
+		pid = proc_nextpid;
+		proc_nextpid = (pid == PID_MAX) ? PID_MIN : pid + 1;
+		if (proc_table[pid % MAX_PROCESS] == NULL) {
+			proc_table[pid % MAX_PROCESS] = proc;
+			proc->p_pid = pid;
+			return 0;
+		}
+	}
+	return ENPROC;
+}
+
+/*
+ * Take PROC out of the table. Call with proc_table_lock held.
+ */
+static
+void
+pid_free(struct proc *proc)
+{
+	KASSERT(proc_table[proc->p_pid % MAX_PROCESS] == proc);
+	proc_table[proc->p_pid % MAX_PROCESS] = NULL;
+	proc->p_pid = 0;
+}
+
+/*
+ * Find the process with pid PID. Call with proc_table_lock held.
+ */
+static
+struct proc *
+pid_lookup(pid_t pid)
+{
+	struct proc *proc;
+
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return NULL;
+	}
+	proc = proc_table[pid % MAX_PROCESS];
+	if (proc == NULL || proc->p_pid != pid) {
+		return NULL;
+	}
+	return proc;
+}
+
 /*
  * Create a proc structure.
  */
@@ -86,20 +159,29 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-	/* initialising open file entry array */
-
-	for (int i = 0; i < OPEN_MAX; i++) {
-		proc->file_table[i] = NULL;
+	/* file descriptor table */
+	proc->file_table = fd_table_create();
+	if (proc->file_table == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
 	}
 
+	/* process table */
+	proc->p_pid = 0;
+	proc->p_ppid = 0;
+	proc->p_exited = false;
+	proc->p_exitstatus = 0;
+	proc->p_vforked = false;
+
 	return proc;
 }
 
 /*
  * Destroy a proc structure.
  *
- * Note: nothing currently calls this. Your wait/exit code will
- * probably want to do so.
+ * Called on fork and runprogram failures, and by proc_exit/proc_wait
+ * to dispose of processes that have exited and been reaped.
  */
 void
 proc_destroy(struct proc *proc)
@@ -126,8 +208,16 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	if (proc->file_table) {
+		fd_table_destroy(proc->file_table);
+		proc->file_table = NULL;
+	}
 
 	/* VM fields */
+	if (proc->p_vforked) {
+		/* The address space is the parent's; leave it alone. */
+		proc->p_addrspace = NULL;
+	}
 	if (proc->p_addrspace) {
 		/*
 		 * If p is the current process, remove it safely from
@@ -175,6 +265,13 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
+	/* Process table; reapers have already taken it out */
+	if (proc->p_pid != 0) {
+		lock_acquire(proc_table_lock);
+		pid_free(proc);
+		lock_release(proc_table_lock);
+	}
+
 	KASSERT(proc->p_numthreads == 0);
 	spinlock_cleanup(&proc->p_lock);
 
@@ -192,6 +289,12 @@ proc_bootstrap(void)
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
+
+	proc_table_lock = lock_create("proc_table");
+	proc_table_cv = cv_create("proc_table");
+	if (proc_table_lock == NULL || proc_table_cv == NULL) {
+		panic("proc_bootstrap: cannot create process table lock\n");
+	}
 }
 
 /*
@@ -204,6 +307,7 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *newproc;
+	int result;
 
 	newproc = proc_create(name);
 	if (newproc == NULL) {
@@ -228,9 +332,229 @@ proc_create_runprogram(const char *name)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	/* Process table: no parent, so it reaps itself on exit */
+	lock_acquire(proc_table_lock);
+	result = pid_alloc(newproc);
+	lock_release(proc_table_lock);
+	if (result) {
+		proc_destroy(newproc);
+		return NULL;
+	}
+
 	return newproc;
 }
 
+/*
+ * Create a child of the current process for fork: a copy of its
+ * address space, sharing its open files and current directory, with
+ * a new pid. The caller gives it a thread.
+ *
+ * For vfork the child doesn't get a copy: it runs on our address
+ * space itself until it execs or exits, and the caller must wait in
+ * proc_vfork_wait until then.
+ */
+int
+proc_fork(struct proc **ret, bool vfork)
+{
+	struct proc *newproc;
+	struct addrspace *as;
+	fd_table *fdt;
+	int result;
+
+	newproc = proc_create(curproc->p_name);
+	if (newproc == NULL) {
+		return ENOMEM;
+	}
+
+	/* VM fields */
+	as = proc_getas();
+	if (vfork) {
+		newproc->p_addrspace = as;
+		newproc->p_vforked = true;
+	}
+	else if (as != NULL) {
+		result = as_copy(as, &newproc->p_addrspace);
+		if (result) {
+			proc_destroy(newproc);
+			return result;
+		}
+	}
+
+	/* VFS fields */
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		newproc->p_cwd = curproc->p_cwd;
+	}
+	spinlock_release(&curproc->p_lock);
+
+	/* file descriptor table: replace the empty one with a copy */
+	fdt = fd_table_copy(curproc->file_table);
+	if (fdt == NULL) {
+		proc_destroy(newproc);
+		return ENOMEM;
+	}
+	fd_table_destroy(newproc->file_table);
+	newproc->file_table = fdt;
+
+	/* process table */
+	lock_acquire(proc_table_lock);
+	result = pid_alloc(newproc);
+	if (result == 0) {
+		newproc->p_ppid = curproc->p_pid;
+	}
+	lock_release(proc_table_lock);
+	if (result) {
+		proc_destroy(newproc);
+		return result;
+	}
+
+	*ret = newproc;
+	return 0;
+}
+
+/*
+ * Sleep until our vfork child CHILD is done with our address space.
+ * The child can't be reaped meanwhile: only we can do that.
+ */
+void
+proc_vfork_wait(struct proc *child)
+{
+	lock_acquire(proc_table_lock);
+	while (child->p_vforked) {
+		cv_wait(proc_table_cv, proc_table_lock);
+	}
+	lock_release(proc_table_lock);
+}
+
+/*
+ * Called by a vfork child that has switched away from (execv) or
+ * dropped (proc_exit) its parent's address space, to wake the parent.
+ */
+void
+proc_vfork_release(void)
+{
+	struct proc *proc = curproc;
+
+	KASSERT(proc->p_vforked);
+
+	lock_acquire(proc_table_lock);
+	proc->p_vforked = false;
+	cv_broadcast(proc_table_cv, proc_table_lock);
+	lock_release(proc_table_lock);
+}
+
+/*
+ * Exit the current process. Everything but the proc structure is
+ * released here; that stays in the table as a zombie until the
+ * parent reaps it, or is destroyed right away if there is no parent.
+ * Our children are orphaned, and any that have already exited are
+ * reaped, since nobody can wait for them any more.
+ *
+ * The thread is detached from the process before the exit becomes
+ * visible, so a reaper never destroys a process that still has a
+ * thread.
+ */
+void
+proc_exit(int exitstatus)
+{
+	struct proc *proc = curproc;
+	struct proc *child;
+	struct addrspace *as;
+	unsigned i;
+
+	KASSERT(proc != NULL);
+	KASSERT(proc != kproc);
+
+	/* VFS fields */
+	fd_table_destroy(proc->file_table);
+	proc->file_table = NULL;
+	if (proc->p_cwd) {
+		VOP_DECREF(proc->p_cwd);
+		proc->p_cwd = NULL;
+	}
+
+	/* VM fields; see proc_destroy for why this order */
+	as = proc_setas(NULL);
+	as_deactivate();
+	if (proc->p_vforked) {
+		proc_vfork_release();
+	}
+	else if (as != NULL) {
+		as_destroy(as);
+	}
+
+	proc_remthread(curthread);
+
+	lock_acquire(proc_table_lock);
+	for (i = 0; i < MAX_PROCESS; i++) {
+		child = proc_table[i];
+		if (child == NULL || child->p_ppid != proc->p_pid) {
+			continue;
+		}
+		if (child->p_exited) {
+			pid_free(child);
+			proc_destroy(child);
+		}
+		else {
+			child->p_ppid = 0;
+		}
+	}
+
+	proc->p_exitstatus = exitstatus;
+	proc->p_exited = true;
+	if (proc->p_ppid == 0) {
+		pid_free(proc);
+		proc_destroy(proc);
+	}
+	else {
+		cv_broadcast(proc_table_cv, proc_table_lock);
+	}
+	lock_release(proc_table_lock);
+
+	thread_exit();
+}
+
+/*
+ * Wait for the current process's child PID to exit, hand back its
+ * exit status, destroy it, and set *RETVAL to PID. With WNOHANG, if
+ * the child is still running set *RETVAL to 0 instead of waiting.
+ */
+int
+proc_wait(pid_t pid, int options, int *exitstatus, pid_t *retval)
+{
+	struct proc *child;
+
+	lock_acquire(proc_table_lock);
+
+	child = pid_lookup(pid);
+	if (child == NULL) {
+		lock_release(proc_table_lock);
+		return ESRCH;
+	}
+	if (child->p_ppid != curproc->p_pid || child == curproc) {
+		lock_release(proc_table_lock);
+		return ECHILD;
+	}
+
+	while (!child->p_exited) {
+		if (options & WNOHANG) {
+			lock_release(proc_table_lock);
+			*retval = 0;
+			return 0;
+		}
+		cv_wait(proc_table_cv, proc_table_lock);
+	}
+
+	*exitstatus = child->p_exitstatus;
+	pid_free(child);
+	lock_release(proc_table_lock);
+
+	proc_destroy(child);
+	*retval = pid;
+	return 0;
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -2,6 +2,7 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <kern/limits.h>
+#include <kern/iovec.h>
 #include <kern/stat.h>
 #include <kern/seek.h>
 #include <lib.h>
@@ -14,21 +15,68 @@
 #include <file.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <limits.h>
+#include <kmemcache.h>
+#include "opt-dumbvm.h"
 
 #define MAX_FILENAME_LEN 128
+#define SMALL_IOVCNT 8 // iovecs readv & co. copy in without kmalloc
 
 /* GLOBAL VARIABLES */
 
-int current_of_index; // init to 0
-of_entry open_file_table[OPEN_MAX];
+/*
+ * System-wide open file table. Entries come from an object cache, so
+ * an entry's ref_lock and offset_lock are set up once by of_ctor and
+ * kept while the entry sits free in the cache; an open only has to
+ * fill in the vnode, flags and offset. Pages the cache no longer
+ * needs go back to the VM system.
+ */
+static struct kmem_cache *of_cache;
 
 /* FILE RELATED FUNCTIONS */
 
+/* Construct an open file entry for the cache | return ENOMEM if its
+   offset lock can't be made */
+static int of_ctor(void *obj) {
+
+    of_entry *of = obj;
+
+    spinlock_init(&of->ref_lock);
+    of->offset_lock = lock_create("file_offset");
+    if (of->offset_lock == NULL) {
+        spinlock_cleanup(&of->ref_lock);
+        return ENOMEM;
+    }
+    return 0;
+}
+
+/* Undo of_ctor when the cache gives back an entry's page */
+static void of_dtor(void *obj) {
+
+    of_entry *of = obj;
+
+    lock_destroy(of->offset_lock);
+    spinlock_cleanup(&of->ref_lock);
+}
+
+/* Set up the open file table. Called once at boot. */
+void of_bootstrap(void) {
+
+    of_cache = kmem_cache_create("open file", sizeof(of_entry),
+                                 of_ctor, of_dtor);
+    if (of_cache == NULL)
+        panic("of_bootstrap: Out of memory\n");
+}
+
 /* create a new open file | return pointer to the open_file struct */
 of_entry *create_open_file(void) {
 
-    of_entry *new_open_file = kmalloc(sizeof(of_entry));
-    
+    of_entry *new_open_file = kmem_cache_alloc(of_cache);
+    if (new_open_file == NULL)
+        return NULL; // no memory
+
     new_open_file->file_offset = 0;
     new_open_file->v_ptr = NULL;
     new_open_file->flags = 0;
@@ -37,347 +85,594 @@ of_entry *create_open_file(void) {
     return new_open_file;
 }
 
-/* Free memory associated with open file */
+/* Return an open file to the open file table */
 
 int free_open_file(of_entry *open_file) {
-    
-    if (open_file == NULL) 
+
+    if (open_file == NULL)
         return EBADF; // invalid file
 
-    kfree(open_file);
-    
+    KASSERT(open_file->ref_count == 0);
+
+    kmem_cache_free(of_cache, open_file);
+
+    return 0;
+}
+
+/* Take a reference to an open file, e.g. for a new fd slot */
+void of_incref(of_entry *ofptr) {
+
+    spinlock_acquire(&ofptr->ref_lock);
+    KASSERT(ofptr->ref_count >= 0);
+    ofptr->ref_count++;
+    spinlock_release(&ofptr->ref_lock);
+}
+
+/* Drop a reference from fd_get / fd_remove / of_incref. The last one
+   closes the vnode and recycles the open file. */
+void of_decref(of_entry *ofptr) {
+
+    int last;
+
+    spinlock_acquire(&ofptr->ref_lock);
+    KASSERT(ofptr->ref_count > 0);
+    ofptr->ref_count--;
+    last = (ofptr->ref_count == 0);
+    spinlock_release(&ofptr->ref_lock);
+
+    if (last) {
+#if !OPT_DUMBVM
+        pagecache_purge(ofptr->v_ptr);
+#endif
+        vfs_close(ofptr->v_ptr);
+        free_open_file(ofptr);
+    }
+}
+
+/* FD TABLE FUNCTIONS */
+
+/* index of the lowest clear bit in a word that is not all ones */
+static inline unsigned first_zero_bit(uint32_t word) {
+
+    unsigned bit = 0;
+
+    word = ~word;
+    if ((word & 0xffff) == 0) { word >>= 16; bit += 16; }
+    if ((word & 0xff) == 0) { word >>= 8; bit += 8; }
+    if ((word & 0xf) == 0) { word >>= 4; bit += 4; }
+    if ((word & 0x3) == 0) { word >>= 2; bit += 2; }
+    if ((word & 0x1) == 0) { bit += 1; }
+
+    return bit;
+}
+
+/* create an empty fd table | return NULL if out of memory */
+fd_table *fd_table_create(void) {
+
+    fd_table *fdt = kmalloc(sizeof(fd_table));
+    if (fdt == NULL)
+        return NULL;
+
+    spinlock_init(&fdt->fdt_lock);
+    bzero(fdt->fdt_inuse, sizeof(fdt->fdt_inuse));
+    for (int i = 0; i < OPEN_MAX; i++) {
+        fdt->fdt_files[i] = NULL;
+    }
+
+    // bits past OPEN_MAX in the last word are permanently in use
+    if (OPEN_MAX % 32 != 0)
+        fdt->fdt_inuse[FDT_WORDS - 1] = ~(uint32_t)0 << (OPEN_MAX % 32);
+
+    return fdt;
+}
+
+/* Duplicate a table for fork: the child's fds refer to the same open files
+   (sharing offsets) | return NULL if out of memory */
+fd_table *fd_table_copy(fd_table *src) {
+
+    fd_table *fdt = fd_table_create();
+    if (fdt == NULL)
+        return NULL;
+
+    spinlock_acquire(&src->fdt_lock);
+    for (int w = 0; w < FDT_WORDS; w++) {
+        fdt->fdt_inuse[w] = src->fdt_inuse[w];
+    }
+    for (int fd = 0; fd < OPEN_MAX; fd++) {
+        fdt->fdt_files[fd] = src->fdt_files[fd];
+        if (fdt->fdt_files[fd] != NULL)
+            of_incref(fdt->fdt_files[fd]);
+    }
+    spinlock_release(&src->fdt_lock);
+
+    return fdt;
+}
+
+/* Close every fd still open and free the table. Only the owning process
+   may be using it at this point. */
+void fd_table_destroy(fd_table *fdt) {
+
+    of_entry *old;
+
+    KASSERT(fdt != NULL);
+
+    for (int fd = 0; fd < OPEN_MAX; fd++) {
+        if (fd_remove(fdt, fd, &old) == 0)
+            of_decref(old);
+    }
+
+    spinlock_cleanup(&fdt->fdt_lock);
+    kfree(fdt);
+}
+
+/* Install ofptr in the lowest-numbered free slot of fdt | return EMFILE if
+   the table is full */
+int fd_alloc(fd_table *fdt, of_entry *ofptr, int *fd) {
+
+    spinlock_acquire(&fdt->fdt_lock);
+
+    for (int w = 0; w < FDT_WORDS; w++) {
+        if (fdt->fdt_inuse[w] == ~(uint32_t)0)
+            continue; // every slot in this word is taken
+
+        unsigned bit = first_zero_bit(fdt->fdt_inuse[w]);
+        int slot = w * 32 + bit;
+
+        KASSERT(slot < OPEN_MAX);
+        KASSERT(fdt->fdt_files[slot] == NULL);
+
+        fdt->fdt_inuse[w] |= (uint32_t)1 << bit;
+        fdt->fdt_files[slot] = ofptr;
+        of_incref(ofptr);
+
+        spinlock_release(&fdt->fdt_lock);
+
+        *fd = slot;
+        return 0;
+    }
+
+    spinlock_release(&fdt->fdt_lock);
+    return EMFILE; // too many open files
+}
+
+/* Install ofptr at fd, handing back whatever was there before (or NULL) in
+   *old so the caller can of_decref it outside the lock. Used by dup2, which
+   must swap the slot atomically. */
+int fd_replace(fd_table *fdt, int fd, of_entry *ofptr, of_entry **old) {
+
+    if (fd < 0 || fd >= OPEN_MAX)
+        return EBADF; // invalid fd
+
+    spinlock_acquire(&fdt->fdt_lock);
+
+    *old = fdt->fdt_files[fd];
+    fdt->fdt_files[fd] = ofptr;
+    fdt->fdt_inuse[fd / 32] |= (uint32_t)1 << (fd % 32);
+    of_incref(ofptr);
+
+    spinlock_release(&fdt->fdt_lock);
+
     return 0;
 }
 
-/* Add to open file table if the table has not reached capacity */
+/* Empty slot fd, handing its open file back in *old. The slot's reference
+   is transferred to the caller, who must of_decref it. */
+int fd_remove(fd_table *fdt, int fd, of_entry **old) {
 
-int add_to_of_table(of_entry *ofptr) {
+    if (fd < 0 || fd >= OPEN_MAX)
+        return EBADF; // invalid fd
+
+    spinlock_acquire(&fdt->fdt_lock);
 
-    if (current_of_index >= OPEN_MAX) 
-        return ENFILE; // system filetable full
+    if (fdt->fdt_files[fd] == NULL) {
+        spinlock_release(&fdt->fdt_lock);
+        return EBADF; // fd not open
+    }
+
+    *old = fdt->fdt_files[fd];
+    fdt->fdt_files[fd] = NULL;
+    fdt->fdt_inuse[fd / 32] &= ~((uint32_t)1 << (fd % 32));
 
-    open_file_table[current_of_index] = *ofptr;
-    current_of_index++;
+    spinlock_release(&fdt->fdt_lock);
 
     return 0;
 }
 
+/* Look up fd and take a reference to its open file so a concurrent close
+   cannot free it mid-syscall | return NULL if fd is not open */
+of_entry *fd_get(fd_table *fdt, int fd) {
+
+    of_entry *ofptr;
+
+    if (fd < 0 || fd >= OPEN_MAX)
+        return NULL; // invalid fd
+
+    spinlock_acquire(&fdt->fdt_lock);
+    ofptr = fdt->fdt_files[fd];
+    if (ofptr != NULL)
+        of_incref(ofptr);
+    spinlock_release(&fdt->fdt_lock);
+
+    return ofptr;
+}
+
 /* SYSCALL INTERFACE FUNCTIONS */
 
-int32_t sys_open(userptr_t filename, int flags, mode_t mode) {
+int sys_open(userptr_t filename, int flags, mode_t mode, int32_t *retval) {
 
-    if (filename == NULL) 
+    if (filename == NULL)
         return EFAULT; // invalid filename ptr
 
     // check invalid flags
     int flag_mode = flags & O_ACCMODE;
-    if (flag_mode != O_RDONLY || flag_mode != O_WRONLY || flag_mode != O_RDWR)
-        return EINVAL; 
+    if (flag_mode != O_RDONLY && flag_mode != O_WRONLY && flag_mode != O_RDWR)
+        return EINVAL;
 
-    // Copy filename string into kernel-space 
+    // Copy filename string into kernel-space
     char sname[MAX_FILENAME_LEN];
-    size_t *string_length = NULL;
-    copyinstr(filename, sname, (size_t)MAX_FILENAME_LEN, string_length);
+    int result = copyinstr(filename, sname, sizeof(sname), NULL);
+    if (result)
+        return result;
 
     // Creating open file description, an entry in the system-wide
-    // table of open files 
+    // table of open files
     of_entry *ret = create_open_file();
-    if (ret == NULL) 
+    if (ret == NULL)
         return ENOMEM; // no memory
 
-    // Open file and store virtual node in ret struct
-    int result = vfs_open(sname, flags, mode, &(ret->v_ptr));
-    if (result) 
+    // Open file and store virtual node in ret struct. This is the slow
+    // part and runs without the fd table locked.
+    result = vfs_open(sname, flags, mode, &(ret->v_ptr));
+    if (result) {
+        free_open_file(ret);
         return result; // return error if error exists
-
-    // Inserting open file node into the open file table
-    int ret_val = add_to_of_table(ret);
-    if (ret_val) 
-        return ret_val; // system filetable full
-
-    // The file descriptor returned by a successful call will be the
-    // lowest-numbered file descriptor no currently open for the process    
-    int fd = 3;
-    while (curproc->file_table[fd] != NULL && fd < OPEN_MAX) {
-        fd++;
     }
 
-    if (fd == OPEN_MAX)
-        return EMFILE; // too many open files
-
-    // Inserting open file node into open file table
-    curproc->file_table[fd] = ret;
-    curproc->file_table[fd]->flags = flags & O_ACCMODE; // set access permissions (read or write)
-    curproc->file_table[fd]->ref_count = 1;
+    ret->flags = flag_mode; // set access permissions (read or write)
 
     // If append, set file_offset to the end of the file
     if (flags & O_APPEND) {
         struct stat statbuf;
 
-        result = VOP_STAT(curproc->file_table[fd]->v_ptr, &statbuf); 
-        if (result) 
+        result = VOP_STAT(ret->v_ptr, &statbuf);
+        if (result) {
+            vfs_close(ret->v_ptr);
+            free_open_file(ret);
             return result;
-        
-        curproc->file_table[fd]->file_offset = statbuf.st_size; 
+        }
+
+        ret->file_offset = statbuf.st_size;
     }
-    
-    return fd;
+
+    // The file descriptor returned by a successful call will be the
+    // lowest-numbered file descriptor not currently open for the process
+    int fd;
+    result = fd_alloc(curproc->file_table, ret, &fd);
+    if (result) {
+        vfs_close(ret->v_ptr);
+        free_open_file(ret);
+        return result; // too many open files
+    }
+
+    *retval = fd;
+    return 0;
 }
 
-int32_t sys_close(int fd) {
-    
-    if (fd < 0 || fd >= OPEN_MAX) 
-        return EBADF; // invalid fd
+int sys_close(int fd) {
 
-    if (curproc->file_table[fd] == NULL) 
-        return EBADF; // invalid fd
+    of_entry *old;
 
-    curproc->file_table[fd]->ref_count--;
+    int result = fd_remove(curproc->file_table, fd, &old);
+    if (result)
+        return result; // invalid fd
 
     /* If fd is the last file descriptor referring to the underlying
     open file description, the resources associated with the ofd are freed */
-
-    if (curproc->file_table[fd]->ref_count == 0) {
-
-        vfs_close(curproc->file_table[fd]->v_ptr);
-        free_open_file(curproc->file_table[fd]);
-        
-        curproc->file_table[fd] = NULL; // update fd process table
-
-    }
+    of_decref(old);
 
     return 0;
 }
 
 
-ssize_t sys_read(int fd, void *buf, size_t buflen) {
+/*
+ * Common body of all the read and write calls: do the I/O described by
+ * u on fd. With positional set the transfer happens at u->uio_offset and
+ * the shared file_offset is neither used nor locked, so any number of
+ * threads can do positional I/O on one open file at once; otherwise
+ * offset_lock is held across the VOP call and file_offset advanced by
+ * the amount transferred.
+ */
+static int file_io(int fd, struct uio *u, bool positional, int32_t *retval) {
 
-    // ERROR CHECKING 
+    size_t requested = u->uio_resid;
+    int result;
 
-    if (fd < 0 || fd >= OPEN_MAX) 
-        return EBADF; // invalid fd
+    if (positional && u->uio_offset < 0)
+        return EINVAL; // invalid offset
 
-    if (curproc->file_table[fd] == NULL) 
+    of_entry *file = fd_get(curproc->file_table, fd);
+    if (file == NULL)
         return EBADF; // invalid fd
-    
-    if (buf == NULL) 
-        return EFAULT; // address space invalid
-    
-    if (curproc->file_table[fd]->flags == O_WRONLY) 
-        return EACCES; // file is write only
-    
-    if (buflen <= 0) 
-        return EINVAL; // buflen cannot be 0 or negative
 
-    // READING FILE 
+    if ((u->uio_rw == UIO_READ && file->flags == O_WRONLY) ||
+        (u->uio_rw == UIO_WRITE && file->flags == O_RDONLY)) {
+        of_decref(file);
+        return EBADF; // file not open in this direction
+    }
 
-    struct iovec iov;
-    struct uio u;
+    if (positional && !VOP_ISSEEKABLE(file->v_ptr)) {
+        of_decref(file);
+        return ESPIPE; // cannot do positional I/O on e.g. the console
+    }
 
-    uio_kinit(&iov, &u, buf, buflen, curproc->file_table[fd]->file_offset, UIO_READ);
+    // hold the offset across the I/O so concurrent users of this open
+    // file each get their own chunk
+    if (!positional) {
+        lock_acquire(file->offset_lock);
+        u->uio_offset = file->file_offset;
+    }
 
-    size_t bytes_remaining = u.uio_resid;
+    if (u->uio_rw == UIO_READ)
+        result = VOP_READ(file->v_ptr, u);
+    else
+        result = VOP_WRITE(file->v_ptr, u);
 
-    int result = VOP_READ(curproc->file_table[fd]->v_ptr, &u);
-    if (result) 
-        return result;
+#if !OPT_DUMBVM
+    // keep any cached pages of the file (e.g. mmap'd ones) current,
+    // including after a write that failed part way through
+    if (u->uio_rw == UIO_WRITE && u->uio_resid != requested)
+        pagecache_update(file->v_ptr,
+                         u->uio_offset - (requested - u->uio_resid),
+                         u->uio_offset);
+#endif
 
-    bytes_remaining = buflen - u.uio_resid;
+    // Update file offset
+    if (!positional) {
+        if (result == 0)
+            file->file_offset = u->uio_offset;
+        lock_release(file->offset_lock);
+    }
 
-    curproc->file_table[fd]->file_offset = u.uio_offset;
+    of_decref(file);
+
+    if (result)
+        return result;
 
-    return bytes_remaining;
+    *retval = requested - u->uio_resid;
+    return 0;
 }
 
-ssize_t sys_write(int fd, const void *buf, size_t nbytes) { 
+/* read, write, pread and pwrite: one user buffer, moved directly between
+   the user's memory and the file by uiomove with no kernel bounce buffer */
+static int file_rw(int fd, userptr_t buf, size_t len, off_t pos,
+                   bool positional, enum uio_rw rw, int32_t *retval) {
 
-    // ERROR CHECKING 
-    if (fd < 0 || fd >= OPEN_MAX)
-        return EBADF; // invalid fd
-    
-    if (curproc->file_table[fd] == NULL)
-        return EBADF; // invalid fd
+    // ERROR CHECKING
 
     if (buf == NULL)
         return EFAULT; // address space invalid
 
-    if (curproc->file_table[fd]->flags == O_RDONLY) 
-        return EACCES; // file is read only
-
-    if (nbytes <= 0) 
+    if (len <= 0)
         return EINVAL; // buflen cannot be 0 or negative
 
-    int result;
-
     struct uio u;
     struct iovec iov;
 
-    // Copy buf string into kernel-space 
-    char *buffer = kmalloc(nbytes);  
-    copyin((const_userptr_t)buf, buffer, nbytes);
+    iov.iov_ubase = buf;
+    iov.iov_len = len;
 
-    // Initialise uio suitable for I/O from a kernal buffer
-    uio_kinit(&iov, &u, buffer, nbytes, curproc->file_table[fd]->file_offset, UIO_WRITE);
-    result = VOP_WRITE(curproc->file_table[fd]->v_ptr, &u);
-    if (result) return result;
+    int result = uio_uinit(&iov, 1, &u, pos, rw, proc_getas());
+    if (result)
+        return result;
 
-    // Update file offset
-    curproc->file_table[fd]->file_offset = u.uio_offset;
+    return file_io(fd, &u, positional, retval);
+}
+
+/* readv, writev, preadv and pwritev: an array of user buffers moved by a
+   single VOP call */
+static int file_rwv(int fd, userptr_t iov, int iovcnt, off_t pos,
+                    bool positional, enum uio_rw rw, int32_t *retval) {
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+        return EINVAL; // invalid iovec count
 
-    size_t bytes_written = nbytes - u.uio_resid;
+    struct iovec small_iov[SMALL_IOVCNT];
+    struct iovec *kiov = small_iov;
+    struct uio u;
+    int result;
+
+    // Copy the iovec array (not the data) into kernel-space; the usual
+    // handful of segments fits on the stack
+    if (iovcnt > SMALL_IOVCNT) {
+        kiov = kmalloc(iovcnt * sizeof(struct iovec));
+        if (kiov == NULL)
+            return ENOMEM;
+    }
+
+    result = copyin((const_userptr_t)iov, kiov, iovcnt * sizeof(struct iovec));
+    if (result) {
+        if (kiov != small_iov)
+            kfree(kiov);
+        return result;
+    }
 
-    kfree(buffer);
+    result = uio_uinit(kiov, iovcnt, &u, pos, rw, proc_getas());
+    if (result == 0)
+        result = file_io(fd, &u, positional, retval);
 
-    return bytes_written;  
+    if (kiov != small_iov)
+        kfree(kiov);
+    return result;
 }
 
-off_t sys_lseek(int fd, off_t pos, int whence) {
+int sys_read(int fd, userptr_t buf, size_t buflen, int32_t *retval) {
 
-    if (fd < 0 || fd >= OPEN_MAX) 
-        return EBADF; // invalid fd
+    return file_rw(fd, buf, buflen, 0, false, UIO_READ, retval);
+}
 
-    if (curproc->file_table[fd] == NULL) 
-        return EBADF; // invalid fd
+int sys_write(int fd, userptr_t buf, size_t nbytes, int32_t *retval) {
 
-    if (!VOP_ISSEEKABLE(curproc->file_table[fd]->v_ptr)) {
-        return ESPIPE; // cannot seek
-    }
+    return file_rw(fd, buf, nbytes, 0, false, UIO_WRITE, retval);
+}
 
-    int result;
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos,
+              int32_t *retval) {
+
+    return file_rw(fd, buf, buflen, pos, true, UIO_READ, retval);
+}
+
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t pos,
+               int32_t *retval) {
+
+    return file_rw(fd, buf, nbytes, pos, true, UIO_WRITE, retval);
+}
+
+int sys_readv(int fd, userptr_t iov, int iovcnt, int32_t *retval) {
+
+    return file_rwv(fd, iov, iovcnt, 0, false, UIO_READ, retval);
+}
+
+int sys_writev(int fd, userptr_t iov, int iovcnt, int32_t *retval) {
+
+    return file_rwv(fd, iov, iovcnt, 0, false, UIO_WRITE, retval);
+}
+
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int32_t *retval) {
+
+    return file_rwv(fd, iov, iovcnt, pos, true, UIO_READ, retval);
+}
+
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos,
+                int32_t *retval) {
+
+    return file_rwv(fd, iov, iovcnt, pos, true, UIO_WRITE, retval);
+}
+
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval) {
+
+    of_entry *file = fd_get(curproc->file_table, fd);
+    if (file == NULL)
+        return EBADF; // invalid fd
+
+    int result = 0;
+    off_t new_offset = 0;
     struct stat file_stat; // find stat struct in kern/stat.h
 
-    if (whence == SEEK_SET) {
-        if (pos < 0) 
-            return EINVAL; // invalid offset
+    lock_acquire(file->offset_lock);
+
+    if (!VOP_ISSEEKABLE(file->v_ptr)) {
+        result = ESPIPE; // cannot seek
 
-        // return and set given offset from start of file
-        result = curproc->file_table[fd]->file_offset = pos; 
+    } else if (whence == SEEK_SET) {
+        // set given offset from start of file
+        new_offset = pos;
 
     } else if (whence == SEEK_CUR) {
-        // return and set given offset added to current offset of file
-        result = curproc->file_table[fd]->file_offset += pos; 
+        // set given offset added to current offset of file
+        new_offset = file->file_offset + pos;
 
-        if (result < 0)
-            return EINVAL; // result of offset + cur position cannot be 0
-        
     } else if (whence == SEEK_END) {
-        result = VOP_STAT(curproc->file_table[fd]->v_ptr, &file_stat);
-        if (result) 
-            return result; // return if error
-        
-        // return end of file using size field of file stat
-        result = curproc->file_table[fd]->file_offset = pos + file_stat.st_size; 
-        
-        if (result < 0)
-            return EINVAL; // resulting seek position is negative
+        result = VOP_STAT(file->v_ptr, &file_stat);
+
+        // set end of file using size field of file stat
+        new_offset = pos + file_stat.st_size;
 
     } else {
-        return EINVAL;
+        result = EINVAL;
+    }
+
+    if (result == 0 && new_offset < 0)
+        result = EINVAL; // resulting seek position is negative
+
+    if (result == 0) {
+        file->file_offset = new_offset;
+        *retval = new_offset;
     }
 
+    lock_release(file->offset_lock);
+    of_decref(file);
     return result;
 }
 
-int32_t sys_dup2(int oldfd, int newfd) {
-    
-    if (oldfd < 0 || oldfd >= OPEN_MAX) 
-        return EBADF; // invalid oldfd
-    
-    if (newfd < 0 || newfd >= OPEN_MAX) 
-        return EBADF; // invalid oldfd
-    
-    if (curproc->file_table[oldfd] == NULL) 
-        return EBADF; // invalid fd
+int sys_dup2(int oldfd, int newfd, int32_t *retval) {
 
-    int result;
+    if (newfd < 0 || newfd >= OPEN_MAX)
+        return EBADF; // invalid newfd
 
-    // attempt to close file if new fd is occupied
-    if (curproc->file_table[newfd] != NULL && newfd != oldfd) {
-        result = sys_close(newfd); 
-        if (result)
+    of_entry *file = fd_get(curproc->file_table, oldfd);
+    if (file == NULL)
+        return EBADF; // invalid oldfd
+
+    // put a copy of of_entry in fd into newfd, closing whatever was there
+    if (newfd != oldfd) {
+        of_entry *old;
+        int result = fd_replace(curproc->file_table, newfd, file, &old);
+        if (result) {
+            of_decref(file);
             return result;
+        }
+        if (old != NULL)
+            of_decref(old);
     }
 
-    // put a copy of of_entry in fd into newfd
-    curproc->file_table[newfd] = curproc->file_table[oldfd]; 
-    curproc->file_table[newfd]->ref_count++;
+    of_decref(file);
 
-    return newfd;
+    *retval = newfd;
+    return 0;
 }
 
-/* handling stdin (0), stdout (1), stderr (2) */
-int run_stdio() {
-    
-    int result;
+/* open the console on fd with the given access mode */
+static int open_console(int fd, int flags) {
 
-    /*------------------STDIN---------------------*/
-    of_entry *stdin = create_open_file();
+    char con[] = "con:";
+    of_entry *old;
+    int result;
 
-    curproc->file_table[0] = stdin;
-    if (curproc->file_table[0] == NULL)
+    of_entry *file = create_open_file();
+    if (file == NULL)
         return ENOMEM;
 
-    curproc->file_table[0]->ref_count = 1;
-    curproc->file_table[0]->flags = O_RDONLY;
-
-    struct vnode *stdin_vptr;
-
-    char c0[] = "con:";
-    
-    result = vfs_open(c0, O_RDONLY, 0, &stdin_vptr);
-
-    if (result)
+    result = vfs_open(con, flags, 0, &file->v_ptr);
+    if (result) {
+        free_open_file(file);
         return result; // error handling
+    }
 
-    curproc->file_table[0]->v_ptr = stdin_vptr;
-
-    sys_close(0); // fd 0 can start closed
+    file->flags = flags;
 
-    /*------------------STOUT---------------------*/
+    result = fd_replace(curproc->file_table, fd, file, &old);
+    if (result) {
+        vfs_close(file->v_ptr);
+        free_open_file(file);
+        return result;
+    }
 
-    char c1[] = "con:";
+    if (old != NULL)
+        of_decref(old);
 
-    of_entry *stdout = create_open_file();
+    return 0;
+}
 
-    curproc->file_table[1] = stdout;
-    if (curproc->file_table[1] == NULL)
-        return ENOMEM;
+/* handling stdin (0), stdout (1), stderr (2) */
+int run_stdio(void) {
 
-    curproc->file_table[1]->ref_count = 1;
-    curproc->file_table[1]->flags = O_WRONLY;
+    int result;
 
-    struct vnode *stdout_vptr;
+    /*------------------STDIN---------------------*/
 
-    result = vfs_open(c1, O_WRONLY, 0, &stdout_vptr);
+    // fd 0 can start closed
 
-    curproc->file_table[1]->v_ptr = stdout_vptr;
+    /*------------------STOUT---------------------*/
 
-	if (result)
+    result = open_console(1, O_WRONLY);
+    if (result)
         return result; // error handling
 
     /*------------------STERR---------------------*/
 
-    char c2[] = "con:";
-
-    of_entry *stderr = create_open_file();
-
-    curproc->file_table[2] = stderr;
-    if (curproc->file_table[2] == NULL)
-        return ENOMEM;
-
-    curproc->file_table[2]->ref_count = 1;
-    curproc->file_table[2]->flags = O_WRONLY;
-
-    struct vnode *stderr_vptr;
-
-    result = vfs_open(c2, O_WRONLY, 0, &stderr_vptr);
-
-    curproc->file_table[2]->v_ptr = stderr_vptr;
-
-	if (result) 
+    result = open_console(2, O_WRONLY);
+    if (result)
         return result; // error handling
 
     return 0;
 }
-
-
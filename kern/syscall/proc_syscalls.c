@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/wait.h>
+#include <limits.h>
+#include <lib.h>
+#include <mips/trapframe.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vfs.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * Process system calls: fork, vfork, execv, getpid, waitpid, _exit.
+ */
+
+/*
+ * Thread entry point for a forked child; DATA1 is a heap copy of the
+ * parent's trapframe.
+ */
+static
+void
+fork_child_entry(void *data1, unsigned long data2)
+{
+	(void)data2;
+	enter_forked_process(data1);
+}
+
+/*
+ * fork: the child gets a copy-on-write copy of our address space
+ * (see as_copy), our open files and a copy of our trapframe, and
+ * returns 0 from the same syscall we return its pid from.
+ *
+ * vfork: the same, except that the child runs on our address space
+ * itself, so nothing at all is copied, and we sleep until it has
+ * called execv or _exit.
+ */
+static
+int
+fork_common(struct trapframe *tf, bool vfork, pid_t *retval)
+{
+	struct trapframe *childtf;
+	struct proc *child;
+	int result;
+
+	childtf = kmalloc(sizeof(*childtf));
+	if (childtf == NULL) {
+		return ENOMEM;
+	}
+	*childtf = *tf;
+
+	result = proc_fork(&child, vfork);
+	if (result) {
+		kfree(childtf);
+		return result;
+	}
+
+	/* Read the pid now: the child may exit and be reaped any time. */
+	*retval = child->p_pid;
+
+	result = thread_fork(curthread->t_name, child,
+			     fork_child_entry, childtf, 0);
+	if (result) {
+		kfree(childtf);
+		proc_destroy(child);
+		return result;
+	}
+
+	if (vfork) {
+		proc_vfork_wait(child);
+	}
+	return 0;
+}
+
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	return fork_common(tf, false, retval);
+}
+
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	return fork_common(tf, true, retval);
+}
+
+/*
+ * Copy the NULL-terminated argument vector UARGV in from userspace:
+ * the strings, packed back to back, go into KBUF (ARG_MAX bytes), and
+ * their count and total size into *ARGC and *LEN.
+ */
+static
+int
+execv_copyin_args(userptr_t uargv, char *kbuf, int *argc, size_t *len)
+{
+	userptr_t uarg;
+	size_t used, got;
+	int i, result;
+
+	used = 0;
+	for (i = 0; ; i++) {
+		result = copyin(uargv + i * sizeof(userptr_t), &uarg,
+				sizeof(uarg));
+		if (result) {
+			return result;
+		}
+		if (uarg == NULL) {
+			break;
+		}
+
+		/* The argv pointers count against ARG_MAX too. */
+		if ((i + 1) * sizeof(userptr_t) + used >= ARG_MAX) {
+			return E2BIG;
+		}
+		result = copyinstr(uarg, kbuf + used,
+				   ARG_MAX - (i + 1) * sizeof(userptr_t) - used,
+				   &got);
+		if (result == ENAMETOOLONG) {
+			return E2BIG;
+		}
+		if (result) {
+			return result;
+		}
+		used += got;
+	}
+
+	*argc = i;
+	*len = used;
+	return 0;
+}
+
+/*
+ * Lay out the ARGC strings (LEN bytes) in KBUF on the new user
+ * stack below *STACKPTR, followed by the argv array pointing at
+ * them, and update *STACKPTR and *UARGV.
+ */
+static
+int
+execv_copyout_args(const char *kbuf, int argc, size_t len,
+		   vaddr_t *stackptr, userptr_t *uargv)
+{
+	userptr_t *argv;
+	vaddr_t sp, strings;
+	size_t off;
+	int i, result;
+
+	argv = kmalloc((argc + 1) * sizeof(userptr_t));
+	if (argv == NULL) {
+		return ENOMEM;
+	}
+
+	sp = *stackptr;
+	sp -= ROUNDUP(len, 8);
+	strings = sp;
+	sp -= ROUNDUP((argc + 1) * sizeof(userptr_t), 8);
+
+	off = 0;
+	for (i = 0; i < argc; i++) {
+		argv[i] = (userptr_t)(strings + off);
+		off += strlen(kbuf + off) + 1;
+	}
+	argv[argc] = NULL;
+
+	result = copyout(kbuf, (userptr_t)strings, len);
+	if (result == 0) {
+		result = copyout(argv, (userptr_t)sp,
+				 (argc + 1) * sizeof(userptr_t));
+	}
+	kfree(argv);
+	if (result) {
+		return result;
+	}
+
+	*stackptr = sp;
+	*uargv = (userptr_t)sp;
+	return 0;
+}
+
+/*
+ * execv: replace our program with PROGRAM, passing it ARGS. The new
+ * address space is built alongside the old one, so that on failure we
+ * can go back to the old one and return the error. A vfork child
+ * hands the old one back to its parent instead of destroying it.
+ */
+int
+sys_execv(userptr_t program, userptr_t args)
+{
+	struct addrspace *oldas, *newas;
+	struct vnode *v;
+	vaddr_t entrypoint, stackptr;
+	userptr_t uargv;
+	char *path, *kargs;
+	size_t len;
+	int argc, result;
+
+	path = kmalloc(PATH_MAX);
+	kargs = kmalloc(ARG_MAX);
+	if (path == NULL || kargs == NULL) {
+		result = ENOMEM;
+		goto fail_free;
+	}
+
+	result = copyinstr(program, path, PATH_MAX, NULL);
+	if (result) {
+		goto fail_free;
+	}
+	if (path[0] == '\0') {
+		result = EINVAL;
+		goto fail_free;
+	}
+	result = execv_copyin_args(args, kargs, &argc, &len);
+	if (result) {
+		goto fail_free;
+	}
+
+	result = vfs_open(path, O_RDONLY, 0, &v);
+	if (result) {
+		goto fail_free;
+	}
+
+	newas = as_create();
+	if (newas == NULL) {
+		vfs_close(v);
+		result = ENOMEM;
+		goto fail_free;
+	}
+	oldas = proc_setas(newas);
+	as_activate();
+
+	result = load_elf(v, &entrypoint);
+	vfs_close(v);
+	if (result) {
+		goto fail_restore;
+	}
+
+	result = as_define_stack(newas, &stackptr);
+	if (result) {
+		goto fail_restore;
+	}
+	result = execv_copyout_args(kargs, argc, len, &stackptr, &uargv);
+	if (result) {
+		goto fail_restore;
+	}
+
+	/* Past the point of no return: let go of the old image. */
+	if (curproc->p_vforked) {
+		proc_vfork_release();
+	}
+	else if (oldas != NULL) {
+		as_destroy(oldas);
+	}
+	kfree(path);
+	kfree(kargs);
+
+	enter_new_process(argc, uargv, NULL /*env*/, stackptr, entrypoint);
+	panic("enter_new_process returned\n");
+
+ fail_restore:
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(newas);
+ fail_free:
+	kfree(path);
+	kfree(kargs);
+	return result;
+}
+
+int
+sys_getpid(pid_t *retval)
+{
+	*retval = curproc->p_pid;
+	return 0;
+}
+
+int
+sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval)
+{
+	int exitstatus;
+	int result;
+
+	if (options & ~WNOHANG) {
+		return EINVAL;
+	}
+
+	result = proc_wait(pid, options, &exitstatus, retval);
+	if (result) {
+		return result;
+	}
+
+	if (*retval != 0 && status != NULL) {
+		result = copyout(&exitstatus, status, sizeof(exitstatus));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+void
+sys__exit(int code)
+{
+	proc_exit(_MKWAIT_EXIT(code));
+}
@@ -100,7 +100,10 @@ runprogram(char *progname)
 	}
 
 	// Handle stdio
-	run_stdio();
+	result = run_stdio();
+	if (result) {
+		return result;
+	}
 
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
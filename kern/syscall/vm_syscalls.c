@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <file.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * Memory system calls. Not compiled with dumbvm.
+ */
+
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbreak;
+	int result;
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	result = as_sbrk(as, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+}
+
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int32_t *retval)
+{
+	struct addrspace *as;
+	of_entry *file;
+	struct vnode *v;
+	vaddr_t vaddr;
+	size_t npages;
+	bool shared;
+	int perms, result;
+
+	if (len == 0 || len > USERSPACETOP ||
+	    offset < 0 || offset % PAGE_SIZE != 0 ||
+	    (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+	    (flags & ~(MAP_SHARED | MAP_PRIVATE |
+		       MAP_ANONYMOUS | MAP_POPULATE)) != 0) {
+		return EINVAL;
+	}
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+	    case MAP_SHARED:
+		shared = true;
+		break;
+	    case MAP_PRIVATE:
+		shared = false;
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	file = NULL;
+	v = NULL;
+	if ((flags & MAP_ANONYMOUS) == 0) {
+		file = fd_get(curproc->file_table, fd);
+		if (file == NULL) {
+			return EBADF;
+		}
+		v = file->v_ptr;
+
+		/* Mapping reads the file; a shared writable one writes it. */
+		if (file->flags == O_WRONLY ||
+		    (shared && (prot & PROT_WRITE) &&
+		     file->flags != O_RDWR)) {
+			result = EACCES;
+			goto out;
+		}
+		result = VOP_MMAP(v);
+		if (result) {
+			goto out;
+		}
+	}
+
+	perms = 0;
+	if (prot & PROT_READ) {
+		perms |= RG_R;
+	}
+	if (prot & PROT_WRITE) {
+		perms |= RG_W;
+	}
+	if (prot & PROT_EXEC) {
+		perms |= RG_X;
+	}
+
+	as = proc_getas();
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+	result = as_mmap(as, (vaddr_t)addr, npages, perms, shared,
+			 v, offset, &vaddr);
+	if (result) {
+		goto out;
+	}
+	if (flags & MAP_POPULATE) {
+		/* Only a hint: whatever doesn't fit faults in later. */
+		(void)as_madvise(as, vaddr, npages, MADV_WILLNEED);
+	}
+	*retval = (int32_t)vaddr;
+
+ out:
+	if (file != NULL) {
+		of_decref(file);
+	}
+	return result;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	vaddr_t vaddr = (vaddr_t)addr;
+
+	if (vaddr % PAGE_SIZE != 0 || len == 0 ||
+	    vaddr >= USERSPACETOP || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	return as_munmap(proc_getas(), vaddr, DIVROUNDUP(len, PAGE_SIZE));
+}
+
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+	vaddr_t vaddr = (vaddr_t)addr;
+
+	if (vaddr % PAGE_SIZE != 0 ||
+	    vaddr >= USERSPACETOP || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+	    (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+		return EINVAL;
+	}
+	/* Writes are always synchronous, so MS_ASYNC is MS_SYNC. */
+	return as_msync(proc_getas(), vaddr, DIVROUNDUP(len, PAGE_SIZE));
+}
+
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+	vaddr_t vaddr = (vaddr_t)addr;
+
+	if (vaddr % PAGE_SIZE != 0 ||
+	    vaddr >= USERSPACETOP || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	return as_madvise(proc_getas(), vaddr, DIVROUNDUP(len, PAGE_SIZE),
+			  advice);
+}
+
+/* How many pages of mincore's vector we fill per copyout */
+#define MINCORE_CHUNK	256
+
+int
+sys_mincore(userptr_t addr, size_t len, userptr_t vec)
+{
+	struct addrspace *as;
+	unsigned char buf[MINCORE_CHUNK];
+	vaddr_t vaddr = (vaddr_t)addr;
+	size_t npages, n;
+	int result;
+
+	if (vaddr % PAGE_SIZE != 0 ||
+	    vaddr >= USERSPACETOP || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+
+	/*
+	 * Fill in a chunk at a time: copyout can fault, so it can't be
+	 * done while as_mincore holds as_lock.
+	 */
+	as = proc_getas();
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+	while (npages > 0) {
+		n = npages < MINCORE_CHUNK ? npages : MINCORE_CHUNK;
+		result = as_mincore(as, vaddr, n, buf);
+		if (result) {
+			return result;
+		}
+		result = copyout(buf, vec, n);
+		if (result) {
+			return result;
+		}
+		vaddr += n * PAGE_SIZE;
+		vec += n;
+		npages -= n;
+	}
+	return 0;
+}
@@ -66,10 +66,7 @@ fakethread_create(const char *name)
 	}
 	/* ignore most of the fields, zero everything for tidiness */
 	bzero(t, sizeof(*t));
-	t->t_name = kstrdup(name);
-	if (t->t_name == NULL) {
-		panic("threadlisttest: Out of memory\n");
-	}
+	snprintf(t->t_name, sizeof(t->t_name), "%s", name);
 	t->t_stack = FAKE_MAGIC;
 	threadlistnode_init(&t->t_listnode, t);
 	return t;
@@ -84,7 +81,6 @@ fakethread_destroy(struct thread *t)
 {
 	KASSERT(t->t_stack == FAKE_MAGIC);
 	threadlistnode_cleanup(&t->t_listnode);
-	kfree(t->t_name);
 	kfree(t);
 }
 
@@ -33,13 +33,120 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <kmemcache.h>
 #include <synch.h>
 
+////////////////////////////////////////////////////////////
+//
+// Object caches.
+
+static struct kmem_cache *sem_cache;
+static struct kmem_cache *lock_cache;
+static struct kmem_cache *cv_cache;
+
+/*
+ * Constructors and destructors: the wait channel and spinlock live as
+ * long as the object does in its cache, not just from create to
+ * destroy. The wait channels point at the objects' name arrays, which
+ * are filled in on every create.
+ */
+
+static
+int
+sem_ctor(void *obj)
+{
+	struct semaphore *sem = obj;
+
+	sem->sem_name[0] = '\0';
+	sem->sem_wchan = wchan_create(sem->sem_name);
+	if (sem->sem_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&sem->sem_lock);
+	return 0;
+}
+
+static
+void
+sem_dtor(void *obj)
+{
+	struct semaphore *sem = obj;
+
+	spinlock_cleanup(&sem->sem_lock);
+	wchan_destroy(sem->sem_wchan);
+}
+
+static
+int
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->lk_name[0] = '\0';
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&lock->lk_lock);
+	lock->lk_holder = NULL;
+	return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+	struct lock *lock = obj;
+
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
+}
+
+static
+int
+cv_ctor(void *obj)
+{
+	struct cv *cv = obj;
+
+	cv->cv_name[0] = '\0';
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&cv->cv_wchanlock);
+	return 0;
+}
+
+static
+void
+cv_dtor(void *obj)
+{
+	struct cv *cv = obj;
+
+	spinlock_cleanup(&cv->cv_wchanlock);
+	wchan_destroy(cv->cv_wchan);
+}
+
+void
+synch_bootstrap(void)
+{
+	sem_cache = kmem_cache_create("semaphore", sizeof(struct semaphore),
+				      sem_ctor, sem_dtor);
+	lock_cache = kmem_cache_create("lock", sizeof(struct lock),
+				       lock_ctor, lock_dtor);
+	cv_cache = kmem_cache_create("cv", sizeof(struct cv),
+				     cv_ctor, cv_dtor);
+	if (sem_cache == NULL || lock_cache == NULL || cv_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -48,26 +155,15 @@ struct semaphore *
 sem_create(const char *name, unsigned initial_count)
 {
 	struct semaphore *sem;
-	
-	sem = kmalloc(sizeof(*sem));
-	if (sem == NULL) {
-		return NULL;
-	}
-	
-	sem->sem_name = kstrdup(name);
-	if (sem->sem_name == NULL) {
-		kfree(sem);
-		return NULL;
-	}
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
+	KASSERT(name != NULL);
+
+	sem = kmem_cache_alloc(sem_cache);
+	if (sem == NULL) {
 		return NULL;
 	}
 
-	spinlock_init(&sem->sem_lock);
+	snprintf(sem->sem_name, sizeof(sem->sem_name), "%s", name);
 	sem->sem_count = initial_count;
 
 	return sem;
@@ -78,11 +174,12 @@ sem_destroy(struct semaphore *sem)
 {
 	KASSERT(sem != NULL);
 
-	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_acquire(&sem->sem_lock);
+	KASSERT(wchan_isempty(sem->sem_wchan, &sem->sem_lock));
+	spinlock_release(&sem->sem_lock);
 	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
-	kfree(sem->sem_name);
-	kfree(sem);
+
+	kmem_cache_free(sem_cache, sem);
 }
 
 void
@@ -143,27 +240,16 @@ lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(*lock));
-	if (lock == NULL) {
-		return NULL;
-	}
+	KASSERT(name != NULL);
 
-	lock->lk_name = kstrdup(name);
-	if (lock->lk_name == NULL) {
-		kfree(lock);
+	lock = kmem_cache_alloc(lock_cache);
+	if (lock == NULL) {
 		return NULL;
 	}
 
+	snprintf(lock->lk_name, sizeof(lock->lk_name), "%s", name);
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
-
-	lock->lk_wchan = wchan_create(lock->lk_name);
-	if (lock->lk_wchan == NULL) {
-		kfree(lock->lk_name);
-		kfree(lock);
-		return NULL;
-	}
-	spinlock_init(&lock->lk_lock);
-	lock->lk_holder = NULL;
+	KASSERT(lock->lk_holder == NULL);
 
 	return lock;
 }
@@ -174,11 +260,12 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+	spinlock_acquire(&lock->lk_lock);
+	KASSERT(wchan_isempty(lock->lk_wchan, &lock->lk_lock));
+	spinlock_release(&lock->lk_lock);
 	spinlock_cleanup(&lock->lk_lock);
-	wchan_destroy(lock->lk_wchan);
 
-	kfree(lock->lk_name);
-	kfree(lock);
+	kmem_cache_free(lock_cache, lock);
 }
 
 void
@@ -222,6 +309,29 @@ lock_release(struct lock *lock)
 	spinlock_release(&lock->lk_lock);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+	bool ret;
+
+	DEBUGASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&lock->lk_lock);
+
+	KASSERT(lock->lk_holder != curthread);
+	ret = (lock->lk_holder == NULL);
+	if (ret) {
+		lock->lk_holder = curthread;
+		HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	}
+
+	spinlock_release(&lock->lk_lock);
+
+	return ret;
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -246,25 +356,14 @@ cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(*cv));
-	if (cv == NULL) {
-		return NULL;
-	}
-
-	cv->cv_name = kstrdup(name);
-	if (cv->cv_name==NULL) {
-		kfree(cv);
-		return NULL;
-	}
+	KASSERT(name != NULL);
 
-	cv->cv_wchan = wchan_create(cv->cv_name);
-	if (cv->cv_wchan == NULL) {
-		kfree(cv->cv_name);
-		kfree(cv);
+	cv = kmem_cache_alloc(cv_cache);
+	if (cv == NULL) {
 		return NULL;
 	}
 
-	spinlock_init(&cv->cv_wchanlock);
+	snprintf(cv->cv_name, sizeof(cv->cv_name), "%s", name);
 	return cv;
 }
 
@@ -273,11 +372,12 @@ cv_destroy(struct cv *cv)
 {
 	KASSERT(cv != NULL);
 
+	spinlock_acquire(&cv->cv_wchanlock);
+	KASSERT(wchan_isempty(cv->cv_wchan, &cv->cv_wchanlock));
+	spinlock_release(&cv->cv_wchanlock);
 	spinlock_cleanup(&cv->cv_wchanlock);
-	wchan_destroy(cv->cv_wchan);
 
-	kfree(cv->cv_name);
-	kfree(cv);
+	kmem_cache_free(cv_cache, cv);
 }
 
 void
@@ -43,6 +43,8 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <vm.h>
+#include "opt-dumbvm.h"
 
 /*
  * Structure for a single named device.
@@ -654,6 +656,11 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+#if !OPT_DUMBVM
+	/* Cached pages nobody has mapped hold vnodes; drop them. */
+	(void)pagecache_reclaim();
+#endif
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -745,6 +752,10 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+#if !OPT_DUMBVM
+		(void)pagecache_reclaim();
+#endif
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -38,6 +38,8 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <vm.h>
+#include "opt-dumbvm.h"
 
 
 /* Does most of the work for open(). */
@@ -100,6 +102,11 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		else {
 			result = VOP_TRUNCATE(vn, 0);
 		}
+#if !OPT_DUMBVM
+		if (result == 0) {
+			pagecache_truncate(vn, 0);
+		}
+#endif
 		if (result) {
 			VOP_DECREF(vn);
 			return result;
@@ -139,12 +146,23 @@ vfs_remove(char *path)
 	struct vnode *dir;
 	char name[NAME_MAX+1];
 	int result;
+#if !OPT_DUMBVM
+	struct vnode *vn;
+#endif
 
 	result = vfs_lookparent(path, &dir, name, sizeof(name));
 	if (result) {
 		return result;
 	}
 
+#if !OPT_DUMBVM
+	/* Don't let cached pages keep the file from being reclaimed. */
+	if (VOP_LOOKUP(dir, name, &vn) == 0) {
+		pagecache_purge(vn);
+		VOP_DECREF(vn);
+	}
+#endif
+
 	result = VOP_REMOVE(dir, name);
 	VOP_DECREF(dir);
 
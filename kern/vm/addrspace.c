@@ -29,10 +29,18 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/stat.h>
+#include <kern/mman.h>
 #include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <cpu.h>
+#include <spl.h>
+#include <current.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -40,6 +48,14 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/*
+ * Source of as_id. Zero means nothing and is never handed out. At 64
+ * bits the counter can't wrap in any realistic uptime, so an id is
+ * never reused.
+ */
+static uint64_t as_nextid = 1;
+static struct spinlock as_idlock = SPINLOCK_INITIALIZER;
+
 struct addrspace *
 as_create(void)
 {
@@ -50,40 +66,339 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_regions = NULL;
+	as->as_loading = false;
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+	as->as_lastcpu = NULL;
+	as->as_npaging = 0;
+
+	spinlock_acquire(&as_idlock);
+	as->as_id = as_nextid++;
+	spinlock_release(&as_idlock);
+
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	if (pt_init(as)) {
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
 
+/*
+ * Add an anonymous region to AS. It is put at the head of the list,
+ * where the caller can find it to fill in file backing.
+ */
+static
+int
+as_add_region(struct addrspace *as, vaddr_t vbase, size_t npages, int perms)
+{
+	struct region *rg;
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vbase;
+	rg->rg_npages = npages;
+	rg->rg_perms = perms;
+	rg->rg_vnode = NULL;
+	rg->rg_offset = 0;
+	rg->rg_fvaddr = 0;
+	rg->rg_filesz = 0;
+	rg->rg_flags = 0;
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+	return 0;
+}
+
+/*
+ * Set the file backing of region RG, taking a reference to V.
+ */
+static
+void
+as_set_backing(struct region *rg, struct vnode *v, off_t offset,
+	       vaddr_t fvaddr, size_t filesz)
+{
+	if (v != NULL) {
+		VOP_INCREF(v);
+	}
+	rg->rg_vnode = v;
+	rg->rg_offset = offset;
+	rg->rg_fvaddr = fvaddr;
+	rg->rg_filesz = filesz;
+}
+
+int
+as_perms(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	int perms = 0;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_vbase &&
+		    (vaddr - rg->rg_vbase) / PAGE_SIZE < rg->rg_npages) {
+			perms |= rg->rg_perms;
+		}
+	}
+	return perms;
+}
+
+struct as_copy_args {
+	struct addrspace *old;
+	struct addrspace *new;
+};
+
+/*
+ * pt_foreach callback for as_copy: share the page with the new
+ * address space. Writable pages become copy-on-write in both;
+ * whichever side writes first gets its own copy in vm_fault. Pages
+ * out on swap share the swap slot, and each side reads its own copy
+ * back in. A shared frame can't be paged out, so any swap copy of a
+ * resident page is dropped. MAP_SHARED pages stay shared and writable;
+ * the new address space gets them clean, so writing them back is left
+ * to the old one until the new one writes too.
+ */
+static
+int
+as_copy_page(vaddr_t vpage, pte_t *pte, void *arg)
+{
+	struct as_copy_args *args = arg;
+	pte_t *newpte;
+
+	KASSERT((*pte & PTE_BUSY) == 0);
+	if ((*pte & (PTE_VALID | PTE_SWAPPED)) == 0) {
+		return 0;
+	}
+
+	newpte = pt_insert(args->new, vpage);
+	if (newpte == NULL) {
+		return ENOMEM;
+	}
+	if (*pte & PTE_SWAPPED) {
+		swap_share(PTE_SLOT(*pte));
+		*newpte = *pte;
+		return 0;
+	}
+	if (*pte & PTE_SHARED) {
+		frame_incref(*pte & PTE_FRAME);
+		*newpte = *pte & ~(PTE_REF | PTE_DIRTY);
+		return 0;
+	}
+	if ((*pte & PTE_DIRTY) == 0) {
+		swap_dropcopy(*pte & PTE_FRAME);
+	}
+	if (*pte & PTE_WRITE) {
+		pt_update(args->old, vpage, pte,
+			  (*pte & ~PTE_WRITE) | PTE_COW | PTE_DIRTY);
+	}
+	frame_incref(*pte & PTE_FRAME);
+	*newpte = *pte & ~PTE_REF;
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct as_copy_args args;
+	struct region *rg;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
-	/*
-	 * Write this.
-	 */
+	swap_pause(old);
+	lock_acquire(old->as_lock);
 
-	(void)old;
+	result = 0;
+	for (rg = old->as_regions; rg != NULL && result == 0;
+	     rg = rg->rg_next) {
+		result = as_add_region(newas, rg->rg_vbase, rg->rg_npages,
+				       rg->rg_perms);
+		if (result == 0) {
+			as_set_backing(newas->as_regions, rg->rg_vnode,
+				       rg->rg_offset, rg->rg_fvaddr,
+				       rg->rg_filesz);
+			newas->as_regions->rg_flags = rg->rg_flags;
+			if (rg == old->as_heap) {
+				newas->as_heap = newas->as_regions;
+			}
+		}
+	}
+	newas->as_heapend = old->as_heapend;
+	if (result == 0) {
+		args.old = old;
+		args.new = newas;
+		result = pt_foreach(old, as_copy_page, &args);
+	}
+
+	lock_release(old->as_lock);
+	swap_resume();
+
+	/* The old address space lost write access to its shared pages. */
+	vm_tlbflush();
+
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
 }
 
+/*
+ * pt_foreach callback for as_destroy: drop our reference to the
+ * page's frame or swap slot. ARG is the address space. If it is
+ * still named as the frame's owner, forget that first: after a fork
+ * the frame may live on in the child, and the clock mustn't hand the
+ * pager an address space that has gone away.
+ */
+static
+int
+as_free_page(vaddr_t vpage, pte_t *pte, void *arg)
+{
+	struct addrspace *as = arg;
+
+	(void)vpage;
+
+	KASSERT((*pte & PTE_BUSY) == 0);
+	if (*pte & PTE_VALID) {
+		if ((*pte & PTE_DIRTY) == 0) {
+			swap_dropcopy(*pte & PTE_FRAME);
+		}
+		frame_disown(*pte & PTE_FRAME, as);
+		frame_decref(*pte & PTE_FRAME);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+	return 0;
+}
+
+struct as_sync_args {
+	struct addrspace *as;
+	struct region *rg;
+	vaddr_t start;
+	vaddr_t end;
+	off_t filesize;
+};
+
+/*
+ * pt_foreach callback for as_sync: if the page is in range and has
+ * been written, write it to the file (none of it past the end) and
+ * mark it clean.
+ */
+static
+int
+as_sync_page(vaddr_t vpage, pte_t *pte, void *arg)
+{
+	struct as_sync_args *args = arg;
+	struct iovec iov;
+	struct uio u;
+	off_t off;
+	size_t len;
+	int result;
+
+	if (vpage < args->start || vpage >= args->end ||
+	    (*pte & (PTE_VALID | PTE_SHARED | PTE_DIRTY)) !=
+	    (PTE_VALID | PTE_SHARED | PTE_DIRTY)) {
+		return 0;
+	}
+
+	off = args->rg->rg_offset + (vpage - args->rg->rg_vbase);
+	if (off < args->filesize) {
+		len = PAGE_SIZE;
+		if (args->filesize - off < PAGE_SIZE) {
+			len = args->filesize - off;
+		}
+		uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(*pte & PTE_FRAME),
+			  len, off, UIO_WRITE);
+		result = VOP_WRITE(args->rg->rg_vnode, &u);
+		if (result) {
+			return result;
+		}
+	}
+	pt_update(args->as, vpage, pte, *pte & ~PTE_DIRTY);
+	return 0;
+}
+
+/*
+ * Write the changed MAP_SHARED pages of AS in [START, END) back to
+ * their files. The caller holds as_lock (or is destroying AS). Only
+ * this CPU can have the pages writable in its TLB, and flushing it
+ * makes the next write to each page fault and mark it dirty again.
+ */
+static
+int
+as_sync(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct as_sync_args args;
+	struct region *rg;
+	struct stat st;
+	vaddr_t rgend;
+	int result = 0;
+
+	args.as = as;
+	args.rg = NULL;
+	for (rg = as->as_regions; rg != NULL && result == 0;
+	     rg = rg->rg_next) {
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if ((rg->rg_flags & RGF_SHARED) == 0 || rg->rg_vnode == NULL ||
+		    rgend <= start || rg->rg_vbase >= end) {
+			continue;
+		}
+		result = VOP_STAT(rg->rg_vnode, &st);
+		if (result) {
+			break;
+		}
+		args.rg = rg;
+		args.start = start > rg->rg_vbase ? start : rg->rg_vbase;
+		args.end = end < rgend ? end : rgend;
+		args.filesize = st.st_size;
+		result = pt_foreach(as, as_sync_page, &args);
+	}
+	if (args.rg != NULL) {
+		vm_tlbflush();
+	}
+	return result;
+}
+
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
+
+	/* Nobody is left to report a failure to. */
+	(void)as_sync(as, 0, USERSPACETOP);
+
+	/* The page-out daemon mustn't be holding any of our pages. */
+	swap_pause(as);
+	pt_foreach(as, as_free_page, as);
+	pt_cleanup(as);
+	swap_resume();
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
 
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -91,6 +406,7 @@ void
 as_activate(void)
 {
 	struct addrspace *as;
+	int spl;
 
 	as = proc_getas();
 	if (as == NULL) {
@@ -102,17 +418,33 @@ as_activate(void)
 	}
 
 	/*
-	 * Write this.
+	 * We don't use ASIDs, so the TLB must be emptied of whatever
+	 * address space was there before. If that was us, it can be
+	 * kept, provided we haven't run on another CPU since: our PTEs
+	 * are changed with only a local flush (see as_unmap), so a
+	 * stay elsewhere may have left entries here stale. as_id is
+	 * 64 bits and never reused, so a new address space at an old
+	 * one's address doesn't match.
 	 */
+	spl = splhigh();
+	if (curcpu->c_tlbasid == as->as_id &&
+	    as->as_lastcpu == curcpu->c_self) {
+		curcpu->c_tlbstats.tlbs_flushskips++;
+	}
+	else {
+		vm_tlbflush();
+		curcpu->c_tlbasid = as->as_id;
+		as->as_lastcpu = curcpu->c_self;
+	}
+	splx(spl);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do: as_activate flushes the TLB of whatever was
+	 * there before.
 	 */
 }
 
@@ -122,57 +454,201 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Writes
+ * to a region without WRITEABLE fault, except while loading. The
+ * MIPS TLB can't express read or execute protection, so the other two
+ * are recorded but not enforced.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+	int perms;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+	npages = memsize / PAGE_SIZE;
+
+	if (vaddr >= USERSPACETOP ||
+	    npages > (USERSPACETOP - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+
+	perms = 0;
+	if (readable) {
+		perms |= RG_R;
+	}
+	if (writeable) {
+		perms |= RG_W;
+	}
+	if (executable) {
+		perms |= RG_X;
+	}
+
+	return as_add_region(as, vaddr, npages, perms);
+}
+
+int
+as_define_file_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+		      int readable, int writeable, int executable,
+		      struct vnode *v, off_t offset, size_t filesize)
+{
+	int result;
+
+	if (filesize > memsize) {
+		filesize = memsize;
+	}
+
+	result = as_define_region(as, vaddr, memsize,
+				  readable, writeable, executable);
+	if (result) {
+		return result;
+	}
+	as_set_backing(as->as_regions, v, offset, vaddr, filesize);
+	return 0;
+}
+
+int
+as_fill_page(struct addrspace *as, vaddr_t vpage, vaddr_t kpage)
+{
+	struct region *rg;
+	struct iovec iov;
+	struct uio u;
+	vaddr_t start, end;
+	int result;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vnode == NULL) {
+			continue;
+		}
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+		/* The part of this page the region has file data for */
+		start = vpage > rg->rg_fvaddr ? vpage : rg->rg_fvaddr;
+		end = vpage + PAGE_SIZE;
+		if (end > rg->rg_fvaddr + rg->rg_filesz) {
+			end = rg->rg_fvaddr + rg->rg_filesz;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		uio_kinit(&iov, &u, (void *)(kpage + (start - vpage)),
+			  end - start, rg->rg_offset + (start - rg->rg_fvaddr),
+			  UIO_READ);
+		result = VOP_READ(rg->rg_vnode, &u);
+		if (result) {
+			return result;
+		}
+		if (u.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("vm: short read paging in 0x%x - "
+				"file truncated?\n", vpage);
+			return ENOEXEC;
+		}
+	}
+	return 0;
+}
+
+bool
+as_text_page(struct addrspace *as, vaddr_t vpage,
+	      struct vnode **v, off_t *offset)
+{
+	struct region *rg, *found;
+	off_t off;
+
+	found = NULL;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vpage >= rg->rg_vbase &&
+		    (vpage - rg->rg_vbase) / PAGE_SIZE < rg->rg_npages) {
+			if (found != NULL) {
+				/* Shared with another segment */
+				return false;
+			}
+			found = rg;
+		}
+	}
+
+	if (found == NULL || found->rg_vnode == NULL ||
+	    (found->rg_perms & RG_W) || as->as_loading) {
+		return false;
+	}
+	if (vpage < found->rg_fvaddr ||
+	    vpage + PAGE_SIZE > found->rg_fvaddr + found->rg_filesz) {
+		/* Partly zero-fill */
+		return false;
+	}
+	off = found->rg_offset + (vpage - found->rg_fvaddr);
+	if (off % PAGE_SIZE != 0) {
+		/* Not a whole page of the file */
+		return false;
+	}
+
+	*v = found->rg_vnode;
+	*offset = off;
+	return true;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Pages are allocated as they are touched; all we need to do
+	 * is let the loader write to read-only regions, should it
+	 * write anything.
 	 */
-
-	(void)as;
+	lock_acquire(as->as_lock);
+	as->as_loading = true;
+	lock_release(as->as_lock);
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t heapbase, end;
+	int result;
 
-	(void)as;
+	lock_acquire(as->as_lock);
+	as->as_loading = false;
+
+	/* The heap starts out empty, just past the last segment. */
+	heapbase = 0;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (end > heapbase) {
+			heapbase = end;
+		}
+	}
+	result = as_add_region(as, heapbase, 0, RG_R | RG_W);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	as->as_heap = as->as_regions;
+	as->as_heapend = heapbase;
+	lock_release(as->as_lock);
+
+	/* Drop the writable TLB entries loading left for read-only pages. */
+	vm_tlbflush();
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_add_region(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			       VM_STACKPAGES, RG_R | RG_W);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +656,480 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Return true if any region of AS other than the heap has a page in
+ * the NPAGES pages at VBASE.
+ */
+static
+bool
+as_overlaps(struct addrspace *as, vaddr_t vbase, size_t npages)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg == as->as_heap || rg->rg_npages == 0) {
+			continue;
+		}
+		if (rg->rg_vbase < vbase + npages * PAGE_SIZE &&
+		    vbase < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct as_unmap_args {
+	struct addrspace *as;
+	vaddr_t start;
+	vaddr_t end;
+};
+
+/*
+ * pt_foreach callback for as_unmap: free the page if it is in range.
+ */
+static
+int
+as_unmap_page(vaddr_t vpage, pte_t *pte, void *arg)
+{
+	struct as_unmap_args *args = arg;
+	pte_t old;
+
+	if (vpage < args->start || vpage >= args->end) {
+		return 0;
+	}
+	old = *pte;
+	pt_update(args->as, vpage, pte, 0);
+	return as_free_page(vpage, &old, args->as);
+}
+
+/*
+ * Free every page of AS in [START, END). The caller holds as_lock and
+ * has paused the pager. Only this CPU can have the pages in its TLB:
+ * any other that ran this address space has flushed it since.
+ */
+static
+void
+as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct as_unmap_args args;
+
+	args.as = as;
+	args.start = start;
+	args.end = end;
+	pt_foreach(as, as_unmap_page, &args);
+	vm_tlbflush();
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	vaddr_t oldend, newend, oldtop, newtop;
+	int result = 0;
+
+	/* Shrinking frees pages, which the pager mustn't be writing. */
+	if (amount < 0) {
+		swap_pause(as);
+	}
+	lock_acquire(as->as_lock);
+
+	if (as->as_heap == NULL) {
+		result = EINVAL;
+		goto out;
+	}
+
+	oldend = as->as_heapend;
+	if (amount >= 0 && (vaddr_t)amount > USERSPACETOP - oldend) {
+		result = ENOMEM;
+		goto out;
+	}
+	if (amount < 0 &&
+	    (vaddr_t)0 - (vaddr_t)amount > oldend - as->as_heap->rg_vbase) {
+		result = EINVAL;
+		goto out;
+	}
+	newend = oldend + amount;
+
+	oldtop = ROUNDUP(oldend, PAGE_SIZE);
+	newtop = ROUNDUP(newend, PAGE_SIZE);
+	if (newtop > oldtop &&
+	    as_overlaps(as, oldtop, (newtop - oldtop) / PAGE_SIZE)) {
+		result = ENOMEM;
+		goto out;
+	}
+	if (newtop < oldtop) {
+		as_unmap(as, newtop, oldtop);
+	}
+
+	as->as_heap->rg_npages = (newtop - as->as_heap->rg_vbase) / PAGE_SIZE;
+	as->as_heapend = newend;
+	*oldbreak = oldend;
+
+ out:
+	lock_release(as->as_lock);
+	if (amount < 0) {
+		swap_resume();
+	}
+	return result;
+}
+
+/*
+ * Return the first region of AS with a page in the NPAGES pages at
+ * VBASE, or NULL.
+ */
+static
+struct region *
+as_findoverlap(struct addrspace *as, vaddr_t vbase, size_t npages)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vbase < vbase + npages * PAGE_SIZE &&
+		    vbase < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find NPAGES free pages for mmap: at HINT if possible, or else the
+ * highest run below the stack. Nothing goes below the top of the heap
+ * (or in page 0), so the heap keeps what room it has to grow.
+ */
+static
+int
+as_findgap(struct addrspace *as, vaddr_t hint, size_t npages, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t floor, top, len;
+
+	floor = PAGE_SIZE;
+	if (as->as_heap != NULL) {
+		floor = as->as_heap->rg_vbase +
+			as->as_heap->rg_npages * PAGE_SIZE;
+	}
+	len = npages * PAGE_SIZE;
+
+	if (hint % PAGE_SIZE == 0 && hint >= floor &&
+	    hint < USERSPACETOP && len <= USERSPACETOP - hint &&
+	    as_findoverlap(as, hint, npages) == NULL) {
+		*ret = hint;
+		return 0;
+	}
+
+	top = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+	while (top >= floor && top - floor >= len) {
+		rg = as_findoverlap(as, top - len, npages);
+		if (rg == NULL) {
+			*ret = top - len;
+			return 0;
+		}
+		top = rg->rg_vbase;
+	}
+	return ENOMEM;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t hint, size_t npages, int perms,
+	bool shared, struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	vaddr_t vbase;
+	int result;
+
+	KASSERT(npages > 0);
+
+	lock_acquire(as->as_lock);
+	result = as_findgap(as, hint, npages, &vbase);
+	if (result == 0) {
+		result = as_add_region(as, vbase, npages, perms);
+	}
+	if (result == 0) {
+		if (v != NULL) {
+			as_set_backing(as->as_regions, v, offset, vbase,
+				       npages * PAGE_SIZE);
+		}
+		as->as_regions->rg_flags = RGF_MMAP |
+			(shared ? RGF_SHARED : 0);
+		*ret = vbase;
+	}
+	lock_release(as->as_lock);
+	return result;
+}
+
+bool
+as_mapped_page(struct addrspace *as, vaddr_t vpage,
+	       struct vnode **v, off_t *offset, bool *shared)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if ((rg->rg_flags & RGF_MMAP) && vpage >= rg->rg_vbase &&
+		    (vpage - rg->rg_vbase) / PAGE_SIZE < rg->rg_npages) {
+			break;
+		}
+	}
+	if (rg == NULL ||
+	    (rg->rg_vnode == NULL && (rg->rg_flags & RGF_SHARED) == 0)) {
+		/* Private anonymous memory is like any other */
+		return false;
+	}
+
+	*v = rg->rg_vnode;
+	*offset = rg->rg_offset + (vpage - rg->rg_vbase);
+	*shared = (rg->rg_flags & RGF_SHARED) != 0;
+	return true;
+}
+
+/*
+ * If an mmap'd region of AS straddles VADDR, split it there, so that
+ * munmap can deal in whole regions.
+ */
+static
+int
+as_split_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg, *tail;
+	vaddr_t skip;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if ((rg->rg_flags & RGF_MMAP) && vaddr > rg->rg_vbase &&
+		    (vaddr - rg->rg_vbase) / PAGE_SIZE < rg->rg_npages) {
+			break;
+		}
+	}
+	if (rg == NULL) {
+		return 0;
+	}
+
+	tail = kmalloc(sizeof(struct region));
+	if (tail == NULL) {
+		return ENOMEM;
+	}
+	skip = vaddr - rg->rg_vbase;
+	*tail = *rg;
+	tail->rg_vbase = vaddr;
+	tail->rg_npages -= skip / PAGE_SIZE;
+	if (tail->rg_vnode != NULL) {
+		VOP_INCREF(tail->rg_vnode);
+		tail->rg_offset += skip;
+		tail->rg_fvaddr = vaddr;
+		tail->rg_filesz = tail->rg_npages * PAGE_SIZE;
+		rg->rg_filesz = skip;
+	}
+	rg->rg_npages = skip / PAGE_SIZE;
+	rg->rg_next = tail;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct region *rg, **pp, *dead;
+	vaddr_t end;
+	int result;
+
+	end = vaddr + npages * PAGE_SIZE;
+	dead = NULL;
+
+	/* Write back first; shared pages are never the pager's. */
+	lock_acquire(as->as_lock);
+	result = as_sync(as, vaddr, end);
+	lock_release(as->as_lock);
+	if (result) {
+		return result;
+	}
+
+	swap_pause(as);
+	lock_acquire(as->as_lock);
+
+	result = as_split_region(as, vaddr);
+	if (result == 0) {
+		result = as_split_region(as, end);
+	}
+	if (result) {
+		/* A split alone changes nothing. */
+		goto out;
+	}
+
+	pp = &as->as_regions;
+	while (*pp != NULL) {
+		rg = *pp;
+		if ((rg->rg_flags & RGF_MMAP) == 0 ||
+		    rg->rg_vbase < vaddr || rg->rg_vbase >= end) {
+			pp = &rg->rg_next;
+			continue;
+		}
+		as_unmap(as, rg->rg_vbase,
+			 rg->rg_vbase + rg->rg_npages * PAGE_SIZE);
+		*pp = rg->rg_next;
+		rg->rg_next = dead;
+		dead = rg;
+	}
+
+ out:
+	lock_release(as->as_lock);
+	swap_resume();
+
+	/* Dropping the files can do I/O, so not under the locks. */
+	while (dead != NULL) {
+		rg = dead;
+		dead = rg->rg_next;
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
+	return result;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_sync(as, vaddr, vaddr + npages * PAGE_SIZE);
+	lock_release(as->as_lock);
+	return result;
+}
+
+vaddr_t
+as_faultahead(struct addrspace *as, vaddr_t vpage)
+{
+	struct region *rg;
+	vaddr_t end;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if ((rg->rg_flags & RGF_SEQUENTIAL) && vpage >= rg->rg_vbase &&
+		    (vpage - rg->rg_vbase) / PAGE_SIZE < rg->rg_npages) {
+			end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+			if ((end - vpage) / PAGE_SIZE > VM_FAULTAHEAD) {
+				end = vpage + (VM_FAULTAHEAD + 1) * PAGE_SIZE;
+			}
+			return end;
+		}
+	}
+	return vpage + PAGE_SIZE;
+}
+
+bool
+as_cluster(struct addrspace *as, vaddr_t vpage)
+{
+	struct region *rg, *found;
+	vaddr_t base, end, rgend;
+
+	base = vpage & ~(vaddr_t)(VM_CLUSTER * PAGE_SIZE - 1);
+	end = base + VM_CLUSTER * PAGE_SIZE;
+
+	found = NULL;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rg->rg_vbase < end && base < rgend) {
+			if (found != NULL) {
+				/* Segments share the cluster */
+				return false;
+			}
+			found = rg;
+		}
+	}
+
+	if (found == NULL || as->as_loading ||
+	    (found->rg_perms & RG_W) == 0 ||
+	    found->rg_npages < VM_CLUSTERMIN) {
+		return false;
+	}
+	if ((found->rg_flags & RGF_MMAP) &&
+	    (found->rg_vnode != NULL || (found->rg_flags & RGF_SHARED))) {
+		/* These come from the page cache */
+		return false;
+	}
+	return base >= found->rg_vbase &&
+		end <= found->rg_vbase + found->rg_npages * PAGE_SIZE;
+}
+
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t npages, int advice)
+{
+	struct region *rg;
+	vaddr_t end, rgend;
+	int result;
+
+	end = vaddr + npages * PAGE_SIZE;
+
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+	    case MADV_SEQUENTIAL:
+		lock_acquire(as->as_lock);
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+			if (rg->rg_vbase >= end || rgend <= vaddr) {
+				continue;
+			}
+			if (advice == MADV_SEQUENTIAL) {
+				rg->rg_flags |= RGF_SEQUENTIAL;
+			}
+			else {
+				rg->rg_flags &= ~RGF_SEQUENTIAL;
+			}
+		}
+		lock_release(as->as_lock);
+		return 0;
+
+	    case MADV_WILLNEED:
+		lock_acquire(as->as_lock);
+		vm_prefault(as, vaddr, end);
+		lock_release(as->as_lock);
+		return 0;
+
+	    case MADV_DONTNEED:
+		/* As for munmap, shared pages must reach the file first. */
+		lock_acquire(as->as_lock);
+		result = as_sync(as, vaddr, end);
+		lock_release(as->as_lock);
+		if (result) {
+			return result;
+		}
+		swap_pause(as);
+		lock_acquire(as->as_lock);
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+			if (rg->rg_vbase >= end || rgend <= vaddr) {
+				continue;
+			}
+			if ((rg->rg_flags & RGF_SHARED) &&
+			    rg->rg_vnode == NULL) {
+				/* The only copy is the frame we'd free. */
+				continue;
+			}
+			as_unmap(as,
+				 rg->rg_vbase > vaddr ? rg->rg_vbase : vaddr,
+				 rgend < end ? rgend : end);
+		}
+		lock_release(as->as_lock);
+		swap_resume();
+		return 0;
+	}
+	return EINVAL;
+}
+
+int
+as_mincore(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	   unsigned char *vec)
+{
+	pte_t *pte;
+	size_t i;
+	int result = 0;
+
+	lock_acquire(as->as_lock);
+	for (i = 0; i < npages; i++, vaddr += PAGE_SIZE) {
+		if (as_findoverlap(as, vaddr, 1) == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		pte = pt_lookup(as, vaddr);
+		vec[i] = (pte != NULL && (*pte & PTE_VALID)) ? 1 : 0;
+	}
+	lock_release(as->as_lock);
+	return result;
+}
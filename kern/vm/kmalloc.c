@@ -30,6 +30,9 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
 
 /*
@@ -137,6 +140,10 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+#if NSIZES != KMCACHE_NSIZES
+#error "struct kmcache needs one magazine per block size"
+#endif
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -145,7 +152,7 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref **prevp_samesize;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -160,10 +167,10 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages and their lists. Most kmallocs and
+ * kfrees don't take it, as they are served from per-cpu magazines
+ * of free blocks (see below); it is held to move blocks between
+ * those and the pages.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -339,11 +346,67 @@ freepageref(struct pageref *p)
 ////////////////////////////////////////
 
 /*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
+ * Each size class keeps its pages on one of three lists, by whether
+ * some, none or all of their blocks are free, so that allocation
+ * always takes the first partial page (or failing that an empty one)
+ * without looking at any full ones. The lists are doubly linked
+ * through next_samesize and prevp_samesize (which points at whatever
+ * points at the page), so a page can move between them in O(1).
+ *
+ * Empty pages are kept, up to KHEAP_KEEPEMPTY per size, rather than
+ * freed at once, so that a size that keeps going back and forth
+ * across a page boundary doesn't allocate and free a page each time.
  */
-static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+#define SC_PARTIAL	0
+#define SC_FULL		1
+#define SC_EMPTY	2
+#define SC_NLISTS	3
+
+struct sizeclass {
+	struct pageref *sc_lists[SC_NLISTS];
+	unsigned sc_nempty;		/* pages on sc_lists[SC_EMPTY] */
+};
+
+#define KHEAP_KEEPEMPTY 2
+
+static struct sizeclass sizeclasses[NSIZES];
+
+/*
+ * Page map: for each physical page, the pageref of the subpage page
+ * there, or NULL. Allocated when the first subpage page is.
+ */
+static struct pageref **pagemap;
+static unsigned pagemap_size;
+
+/*
+ * Multi-page size classes (see large_kmalloc). Runs of these sizes
+ * that are freed are kept, up to LARGE_KEEPPAGES pages' worth per
+ * size, on a list linked through the first word of each run.
+ *
+ * largemap, allocated along with the page map, has for the first
+ * page of each run of one of these sizes the size index plus one,
+ * with LM_CACHED set while the run is on its free list, and 0 for
+ * every other page.
+ */
+#define NLARGESIZES 4
+static const unsigned largepages[NLARGESIZES] = { 2, 4, 8, 16 };
+
+#define LM_CACHED 0x80
+
+#ifdef SLOW
+#define LARGE_KEEPPAGES 0
+#else
+#define LARGE_KEEPPAGES 32
+#endif
+
+struct largeclass {
+	vaddr_t lc_free;		/* first cached run, or 0 */
+	unsigned lc_count;		/* runs on lc_free */
+};
+
+static struct largeclass largeclasses[NLARGESIZES];
+static uint8_t *largemap;
+static struct spinlock large_spinlock = SPINLOCK_INITIALIZER;
 
 ////////////////////////////////////////
 
@@ -579,27 +642,41 @@ static
 void
 checksubpages(void)
 {
-	struct pageref *pr;
-	int i;
-	unsigned sc=0, ac=0;
+	struct pageref *pr, **prevp;
+	unsigned i, l, max;
+	unsigned ac=0, nempty;
 
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			checksubpage(pr);
-			KASSERT(sc < TOTAL_PAGEREFS);
-			sc++;
+		max = PAGE_SIZE / sizes[i];
+		nempty = 0;
+		for (l=0; l<SC_NLISTS; l++) {
+			prevp = &sizeclasses[i].sc_lists[l];
+			for (pr = *prevp; pr != NULL; pr = pr->next_samesize) {
+				checksubpage(pr);
+				KASSERT(PR_BLOCKTYPE(pr) == i);
+				KASSERT(pr->prevp_samesize == prevp);
+				switch (l) {
+				    case SC_PARTIAL:
+					KASSERT(pr->nfree > 0);
+					KASSERT(pr->nfree < max);
+					break;
+				    case SC_FULL:
+					KASSERT(pr->nfree == 0);
+					break;
+				    case SC_EMPTY:
+					KASSERT(pr->nfree == max);
+					nempty++;
+					break;
+				}
+				KASSERT(ac < TOTAL_PAGEREFS);
+				ac++;
+				prevp = &pr->next_samesize;
+			}
 		}
+		KASSERT(nempty == sizeclasses[i].sc_nempty);
 	}
-
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
-		ac++;
-	}
-
-	KASSERT(sc==ac);
 }
 #else
 #define checksubpages()
@@ -685,7 +762,13 @@ dump_subpages(unsigned generation)
 
 	kprintf("Remaining allocations from generation %u:\n", generation);
 	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+		/* Empty pages have nothing to show */
+		for (pr = sizeclasses[i].sc_lists[SC_PARTIAL]; pr != NULL;
+		     pr = pr->next_samesize) {
+			dump_subpage(pr, generation);
+		}
+		for (pr = sizeclasses[i].sc_lists[SC_FULL]; pr != NULL;
+		     pr = pr->next_samesize) {
 			dump_subpage(pr, generation);
 		}
 	}
@@ -801,14 +884,34 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i, j, n;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		subpage_stats(pr);
+	for (i=0; i<NSIZES; i++) {
+		for (j=0; j<SC_NLISTS; j++) {
+			for (pr = sizeclasses[i].sc_lists[j]; pr != NULL;
+			     pr = pr->next_samesize) {
+				subpage_stats(pr);
+			}
+		}
+	}
+
+	/* Other CPUs' magazines may be changing; this is a snapshot. */
+	for (i=0; i<cpu_count(); i++) {
+		n = 0;
+		for (j=0; j<NSIZES; j++) {
+			n += cpu_get(i)->c_kmcache.kc_count[j];
+		}
+		kprintf("cpu%u: %u blocks cached (shown as in use)\n", i, n);
+	}
+
+	for (i=0; i<NLARGESIZES; i++) {
+		kprintf("%uk runs: %u cached\n", largepages[i] * PAGE_SIZE / 1024,
+			largeclasses[i].lc_count);
 	}
 
 	spinlock_release(&kmalloc_spinlock);
@@ -817,31 +920,36 @@ kheap_printstats(void)
 ////////////////////////////////////////
 
 /*
- * Remove a pageref from both lists that it's on.
+ * Put a pageref at the head of list LIST of its size class.
  */
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+pr_link(struct pageref *pr, unsigned list)
 {
-	struct pageref **guy;
-
-	KASSERT(blktype>=0 && blktype<NSIZES);
+	struct pageref **head;
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	head = &sizeclasses[PR_BLOCKTYPE(pr)].sc_lists[list];
+	pr->next_samesize = *head;
+	if (*head != NULL) {
+		(*head)->prevp_samesize = &pr->next_samesize;
 	}
+	pr->prevp_samesize = head;
+	*head = pr;
+}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+/*
+ * Remove a pageref from the list that it's on.
+ */
+static
+void
+pr_unlink(struct pageref *pr)
+{
+	*pr->prevp_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prevp_samesize = pr->prevp_samesize;
 	}
+	pr->next_samesize = NULL;
+	pr->prevp_samesize = NULL;
 }
 
 /*
@@ -867,90 +975,252 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Allocate the page map (see pagemap_lookup) and largemap. Called
+ * with kmalloc_spinlock held, which is dropped and retaken around
+ * alloc_kpages just as in allocpagerefpage.
+ */
+static
+void
+allocpagemap(void)
+{
+	unsigned n, npages, i;
+	vaddr_t va;
+
+	KASSERT(pagemap == NULL);
+
+	n = ram_getsize() / PAGE_SIZE;
+	npages = DIVROUNDUP(n * (sizeof(struct pageref *) + sizeof(uint8_t)),
+			    PAGE_SIZE);
+
+	spinlock_release(&kmalloc_spinlock);
+	va = alloc_kpages(npages);
+	spinlock_acquire(&kmalloc_spinlock);
+	if (va == 0) {
+		kprintf("kmalloc: Couldn't get the page map\n");
+		return;
+	}
+
+	if (pagemap != NULL) {
+		/* Somebody else got there first. */
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(va);
+		spinlock_acquire(&kmalloc_spinlock);
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		((struct pageref **)va)[i] = NULL;
+		((uint8_t *)va)[n * sizeof(struct pageref *) + i] = 0;
+	}
+	pagemap_size = n;
+	largemap = (uint8_t *)va + n * sizeof(struct pageref *);
+	pagemap = (struct pageref **)va;
+}
+
+/*
+ * Find the pageref of the heap page holding ADDR, or NULL if it isn't
+ * on one. This needs no lock: a page's entry is only set or cleared
+ * while nothing on the page is allocated, so it can't change under
+ * anyone freeing a block there.
+ */
+static
+struct pageref *
+pagemap_lookup(vaddr_t addr)
+{
+	paddr_t pn;
+
+	if (pagemap == NULL) {
+		return NULL;
+	}
+	pn = KVADDR_TO_PADDR(addr) / PAGE_SIZE;
+	if (pn >= pagemap_size) {
+		return NULL;
+	}
+	return pagemap[pn];
+}
+
+static
+void
+pagemap_set(vaddr_t prpage, struct pageref *pr)
+{
+	paddr_t pn;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	pn = KVADDR_TO_PADDR(prpage) / PAGE_SIZE;
+	KASSERT(pn < pagemap_size);
+	pagemap[pn] = pr;
+}
+
+/*
+ * Take a free block of type BLKTYPE off the first partial page of
+ * that size, or an empty one if there are no partial ones, or return
+ * NULL if there are neither. Called with kmalloc_spinlock held.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_getblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
+	struct sizeclass *sc;	// the size class
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
+	bool wasempty;
 
-	volatile int i;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
+	sc = &sizeclasses[blktype];
+	wasempty = false;
+	pr = sc->sc_lists[SC_PARTIAL];
+	if (pr == NULL) {
+		pr = sc->sc_lists[SC_EMPTY];
+		if (pr == NULL) {
+			return NULL;
+		}
+		wasempty = true;
+	}
 
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
+	/* check for corruption */
+	KASSERT(PR_BLOCKTYPE(pr) == blktype);
+	checksubpage(pr);
+	KASSERT(pr->nfree > 0);
 
-	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-	checksubpages();
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+
+	if (wasempty) {
+		sc->sc_nempty--;
+	}
+	if (wasempty || pr->nfree == 0) {
+		pr_unlink(pr);
+		pr_link(pr, pr->nfree == 0 ? SC_FULL : SC_PARTIAL);
+	}
+	return retptr;
+}
+
+/*
+ * Put the block at PTRADDR back on its page PR. If that leaves the
+ * whole page free, and its size already has KHEAP_KEEPEMPTY empty
+ * pages, take the page off the lists and return its address, for the
+ * caller to hand to free_kpages once it has let go of
+ * kmalloc_spinlock; otherwise return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	struct sizeclass *sc;	// sizeclasses[blktype]
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	bool wasfull;
 
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-		if (pr->nfree > 0) {
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	sc = &sizeclasses[blktype];
+	checksubpage(pr);
+	wasfull = pr->nfree == 0;
 
-		doalloc: /* comes here after getting a whole fresh page */
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+	fl = (struct freelist *)ptraddr;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
 #endif
+	}
+	pr->freelist_offset = ptraddr - prpage;
+	pr->nfree++;
 
-			checksubpages();
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		pr_unlink(pr);
+		if (sc->sc_nempty < KHEAP_KEEPEMPTY) {
+			pr_link(pr, SC_EMPTY);
+			sc->sc_nempty++;
+			return 0;
+		}
+		pagemap_set(prpage, NULL);
+		freepageref(pr);
+		return prpage;
+	}
+	if (wasfull) {
+		pr_unlink(pr);
+		pr_link(pr, SC_PARTIAL);
+	}
+	return 0;
+}
+
+/*
+ * Allocate a block of type BLKTYPE from the pages, getting a fresh
+ * page if none of them has a free block.
+ */
+static
+void *
+subpage_allocblock(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for the new page
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+	void *retptr;		// our result
+
+	volatile int i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	retptr = subpage_getblock(blktype);
+	if (retptr != NULL) {
+		checksubpages();
+		spinlock_release(&kmalloc_spinlock);
+		return retptr;
+	}
 
+	if (pagemap == NULL) {
+		allocpagemap();
+		if (pagemap == NULL) {
 			spinlock_release(&kmalloc_spinlock);
-			return retptr;
+			return NULL;
 		}
 	}
 
@@ -1007,14 +1277,239 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
+	/* It goes on the empty list, for subpage_getblock to find. */
+	pr_link(pr, SC_EMPTY);
+	sizeclasses[blktype].sc_nempty++;
+
+	pagemap_set(prpage, pr);
+
+	retptr = subpage_getblock(blktype);
+	KASSERT(retptr != NULL);
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+	return retptr;
+}
+
+////////////////////////////////////////
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each CPU keeps a short list of free blocks of each size (struct
+ * kmcache in <cpu.h>), chained through their first word, and most
+ * kmallocs and kfrees are a push or pop there at splhigh, without
+ * kmalloc_spinlock. An empty magazine is refilled, and a full one
+ * half emptied, a batch of blocks at a time under the lock. A
+ * magazine holds at most a page's worth of blocks, so the big sizes
+ * don't pin much memory.
+ *
+ * Blocks in a magazine still count as allocated as far as the pages
+ * are concerned. SLOW turns the magazines off, so that every free
+ * block is on its page for checksubpage to look at.
+ */
+
+#define KMCACHE_MAX 32
+
+#ifdef SLOW
+#define KMCACHE_ON() 0
+#else
+#define KMCACHE_ON() CURCPU_EXISTS()
+#endif
+
+static
+unsigned
+kmcache_max(unsigned blktype)
+{
+	unsigned n;
+
+	n = PAGE_SIZE / sizes[blktype];
+	return n < KMCACHE_MAX ? n : KMCACHE_MAX;
+}
+
+/*
+ * Move up to half a magazine of blocks of type BLKTYPE from the pages
+ * into KC. Called at splhigh.
+ */
+static
+void
+kmcache_refill(struct kmcache *kc, unsigned blktype)
+{
+	struct freelist *fl;
+	unsigned batch;
+
+	batch = kmcache_max(blktype) / 2;
+	if (batch == 0) {
+		batch = 1;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	while (kc->kc_count[blktype] < batch) {
+		fl = subpage_getblock(blktype);
+		if (fl == NULL) {
+			break;
+		}
+		fl->next = kc->kc_blocks[blktype];
+		kc->kc_blocks[blktype] = fl;
+		kc->kc_count[blktype]++;
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Give half of KC's (full) magazine of type BLKTYPE back to the
+ * pages. Pages that come free are chained through their first word
+ * and handed to free_kpages after the lock is dropped. Called at
+ * splhigh.
+ */
+static
+void
+kmcache_drain(struct kmcache *kc, unsigned blktype)
+{
+	struct freelist *fl;
+	struct pageref *pr;
+	vaddr_t page, freepages;
+	unsigned batch, i;
+
+	batch = kmcache_max(blktype) / 2;
+	if (batch == 0) {
+		batch = 1;
+	}
+
+	freepages = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<batch && kc->kc_count[blktype] > 0; i++) {
+		fl = kc->kc_blocks[blktype];
+		kc->kc_blocks[blktype] = fl->next;
+		kc->kc_count[blktype]--;
+
+		pr = pagemap_lookup((vaddr_t)fl);
+		KASSERT(pr != NULL);
+		page = subpage_putblock(pr, (vaddr_t)fl);
+		if (page != 0) {
+			*(vaddr_t *)page = freepages;
+			freepages = page;
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	while (freepages != 0) {
+		page = freepages;
+		freepages = *(vaddr_t *)page;
+		free_kpages(page);
+	}
+}
+
+/*
+ * Take a block of type BLKTYPE from this CPU's magazine, refilling it
+ * if it is empty. Returns NULL if the pages have no free blocks of
+ * that size either; the caller then goes to subpage_allocblock, which
+ * can get a new page.
+ */
+static
+void *
+kmcache_alloc(unsigned blktype)
+{
+	struct kmcache *kc;
+	struct freelist *fl;
+	int spl;
+
+	spl = splhigh();
+	kc = &curcpu->c_kmcache;
+	if (kc->kc_count[blktype] == 0) {
+		kmcache_refill(kc, blktype);
+	}
+	fl = kc->kc_blocks[blktype];
+	if (fl != NULL) {
+		kc->kc_blocks[blktype] = fl->next;
+		kc->kc_count[blktype]--;
+	}
+	splx(spl);
+
+	return fl;
+}
+
+/*
+ * Put the free block at PTRADDR, of type BLKTYPE, in this CPU's
+ * magazine, making room first if it is full.
+ */
+static
+void
+kmcache_free(unsigned blktype, vaddr_t ptraddr)
+{
+	struct kmcache *kc;
+	struct freelist *fl;
+	int spl;
+
+	fl = (struct freelist *)ptraddr;
+
+	spl = splhigh();
+	kc = &curcpu->c_kmcache;
+	if (kc->kc_count[blktype] >= kmcache_max(blktype)) {
+		kmcache_drain(kc, blktype);
+	}
+	fl->next = kc->kc_blocks[blktype];
+	kc->kc_blocks[blktype] = fl;
+	kc->kc_count[blktype]++;
+	splx(spl);
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
 
-	pr->next_all = allbase;
-	allbase = pr;
+	retptr = NULL;
+	if (KMCACHE_ON()) {
+		retptr = kmcache_alloc(blktype);
+	}
+	if (retptr == NULL) {
+		retptr = subpage_allocblock(blktype);
+		if (retptr == NULL) {
+			return NULL;
+		}
+	}
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
 }
 
 /*
@@ -1029,8 +1524,6 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
@@ -1061,34 +1554,16 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = pagemap_lookup(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1108,47 +1583,19 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
+	if (KMCACHE_ON()) {
+		kmcache_free(blktype, ptraddr);
+		return 0;
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	prpage = subpage_putblock(pr, ptraddr);
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
 		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -1159,12 +1606,196 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+////////////////////////////////////////
+
+/*
+ * Multi-page blocks.
+ *
+ * Blocks of more than one page and up to 64k are rounded up to a
+ * power of two pages, and the runs are kept on a list per size when
+ * freed instead of going straight back to free_kpages. That way the
+ * exec argument buffer and other allocations of that kind don't
+ * split and merge frame allocator blocks under the frame table lock
+ * every time, and runs of one size keep being reused rather than
+ * being broken up by other sizes. Single pages are left to
+ * alloc_kpages, whose per-CPU frame cache already does better than
+ * a shared list could; larger blocks than 64k are rare enough not to
+ * bother with. All of these are page-aligned, as thread stacks rely
+ * on.
+ */
+
+/*
+ * Return the index into largepages[] for a block of NPAGES pages, or
+ * -1 if it isn't one of ours.
+ */
+static
+int
+largetype(unsigned long npages)
+{
+	unsigned i;
+
+	if (npages < 2) {
+		return -1;
+	}
+	for (i=0; i<NLARGESIZES; i++) {
+		if (npages <= largepages[i]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Find the largemap entry for ADDR, or NULL if there is none.
+ */
+static
+uint8_t *
+largemap_lookup(vaddr_t addr)
+{
+	paddr_t pn;
+
+	if (largemap == NULL) {
+		return NULL;
+	}
+	pn = KVADDR_TO_PADDR(addr) / PAGE_SIZE;
+	if (pn >= pagemap_size) {
+		return NULL;
+	}
+	return &largemap[pn];
+}
+
+/*
+ * Free every cached run. Returns the number of pages released.
+ */
+unsigned
+kheap_reclaim(void)
+{
+	struct largeclass *lc;
+	vaddr_t runs, address;
+	unsigned i, npages;
+
+	npages = 0;
+	for (i=0; i<NLARGESIZES; i++) {
+		lc = &largeclasses[i];
+
+		spinlock_acquire(&large_spinlock);
+		runs = lc->lc_free;
+		lc->lc_free = 0;
+		lc->lc_count = 0;
+		spinlock_release(&large_spinlock);
+
+		/* The runs are ours now; free them without the lock. */
+		while (runs != 0) {
+			address = runs;
+			runs = *(vaddr_t *)address;
+			*largemap_lookup(address) = 0;
+			free_kpages(address);
+			npages += largepages[i];
+		}
+	}
+	return npages;
+}
+
+/*
+ * Allocate NPAGES pages, from the cached runs if it's one of our
+ * sizes.
+ */
+static
+void *
+large_kmalloc(unsigned long npages)
+{
+	struct largeclass *lc;
+	vaddr_t address;
+	int lt;
+
+	lt = largetype(npages);
+	if (lt >= 0 && largemap == NULL) {
+		spinlock_acquire(&kmalloc_spinlock);
+		if (pagemap == NULL) {
+			allocpagemap();
+		}
+		spinlock_release(&kmalloc_spinlock);
+	}
+	if (lt < 0 || largemap == NULL) {
+		return (void *)alloc_kpages(npages);
+	}
+	lc = &largeclasses[lt];
+
+	spinlock_acquire(&large_spinlock);
+	address = lc->lc_free;
+	if (address != 0) {
+		KASSERT(*largemap_lookup(address) == (LM_CACHED | (lt + 1)));
+		lc->lc_free = *(vaddr_t *)address;
+		lc->lc_count--;
+		*largemap_lookup(address) = lt + 1;
+	}
+	spinlock_release(&large_spinlock);
+	if (address != 0) {
+		return (void *)address;
+	}
+
+	address = alloc_kpages(largepages[lt]);
+	if (address == 0 && kheap_reclaim() > 0) {
+		address = alloc_kpages(largepages[lt]);
+	}
+	if (address == 0) {
+		return NULL;
+	}
+	*largemap_lookup(address) = lt + 1;
+	return (void *)address;
+}
+
+/*
+ * Free a block previously returned from large_kmalloc for one of our
+ * sizes. If it isn't one, return -1.
+ */
+static
+int
+large_kfree(void *ptr)
+{
+	struct largeclass *lc;
+	vaddr_t address;
+	uint8_t *lm;
+	int lt;
+
+	address = (vaddr_t)ptr;
+	if (address % PAGE_SIZE != 0) {
+		return -1;
+	}
+	lm = largemap_lookup(address);
+	if (lm == NULL || *lm == 0) {
+		return -1;
+	}
+
+	spinlock_acquire(&large_spinlock);
+	if (*lm & LM_CACHED) {
+		panic("kfree: double free of multipage block %p\n", ptr);
+	}
+	lt = *lm - 1;
+	KASSERT(lt >= 0 && lt < NLARGESIZES);
+	lc = &largeclasses[lt];
+	if (lc->lc_count < LARGE_KEEPPAGES / largepages[lt]) {
+		*(vaddr_t *)address = lc->lc_free;
+		lc->lc_free = address;
+		lc->lc_count++;
+		*lm |= LM_CACHED;
+		address = 0;
+	}
+	spinlock_release(&large_spinlock);
+
+	if (address != 0) {
+		*lm = 0;
+		free_kpages(address);
+	}
+	return 0;
+}
+
 //
 ////////////////////////////////////////////////////////////
 
 /*
  * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * large_kmalloc depending on how big SZ is.
  */
 void *
 kmalloc(size_t sz)
@@ -1185,17 +1816,14 @@ kmalloc(size_t sz)
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
-		vaddr_t address;
+		void *ptr;
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
-			return NULL;
-		}
-		KASSERT(address % PAGE_SIZE == 0);
+		ptr = large_kmalloc(npages);
+		KASSERT((vaddr_t)ptr % PAGE_SIZE == 0);
 
-		return (void *)address;
+		return ptr;
 	}
 
 #ifdef LABELS
@@ -1212,11 +1840,12 @@ void
 kfree(void *ptr)
 {
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Try subpage first, then the multipage sizes; if both fail,
+	 * assume it's a big allocation.
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	} else if (subpage_kfree(ptr) && large_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
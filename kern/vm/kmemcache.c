@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmemcache.h>
+
+/*
+ * Object caches (slab allocator).
+ *
+ * Each cache carves whole pages from alloc_kpages into slabs of
+ * equal-sized slots. The slab header sits at the start of its page,
+ * so kmem_cache_free finds an object's slab by rounding its address
+ * down. A slot holds the object and then a link word for the slab's
+ * free list. The link is kept apart from the object so that a free
+ * object stays constructed.
+ *
+ * Like the subpage pools in kmalloc.c, slabs are kept on partial,
+ * full and empty lists, so allocation is O(1). One empty slab is kept
+ * in reserve; beyond that, empty slabs are destroyed and their pages
+ * given back.
+ *
+ * A new slab is built, constructors and all, without the cache's
+ * lock. It is only taken to move objects on and off slabs.
+ */
+
+#define KMEM_KEEPEMPTY	1	/* empty slabs held back per cache */
+#define KMEM_ALIGN	8	/* object alignment */
+
+struct kmem_slab {
+	struct kmem_slab *sl_next;
+	struct kmem_slab **sl_prevp;	/* whatever points at us */
+	struct kmem_cache *sl_cache;
+	void *sl_free;			/* free objects */
+	unsigned sl_inuse;		/* objects handed out */
+};
+
+#define SL_OBJOFFSET	ROUNDUP(sizeof(struct kmem_slab), KMEM_ALIGN)
+
+struct kmem_cache {
+	char *kc_name;
+	size_t kc_size;			/* object size asked for */
+	size_t kc_linkoff;		/* offset of the free list link */
+	size_t kc_slotsize;		/* object, link and padding */
+	unsigned kc_perslab;		/* objects in a slab */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;	/* protects all below */
+	struct kmem_slab *kc_partial;	/* some objects free */
+	struct kmem_slab *kc_full;	/* no objects free */
+	struct kmem_slab *kc_empty;	/* all objects free */
+	unsigned kc_nempty;		/* slabs on kc_empty */
+	unsigned kc_nslabs;		/* slabs altogether */
+	unsigned kc_inuse;		/* objects handed out */
+
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+};
+
+#define KC_LINK(kc, obj) (*(void **)((char *)(obj) + (kc)->kc_linkoff))
+
+/* All caches, for kmem_printstats. */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+
+static
+void
+slab_link(struct kmem_slab **head, struct kmem_slab *sl)
+{
+	sl->sl_next = *head;
+	if (*head != NULL) {
+		(*head)->sl_prevp = &sl->sl_next;
+	}
+	sl->sl_prevp = head;
+	*head = sl;
+}
+
+static
+void
+slab_unlink(struct kmem_slab *sl)
+{
+	*sl->sl_prevp = sl->sl_next;
+	if (sl->sl_next != NULL) {
+		sl->sl_next->sl_prevp = sl->sl_prevp;
+	}
+	sl->sl_next = NULL;
+	sl->sl_prevp = NULL;
+}
+
+/*
+ * Destroy a slab, none of whose objects are in use: run the
+ * destructor on each of them and give back the page.
+ */
+static
+void
+slab_destroy(struct kmem_cache *kc, struct kmem_slab *sl)
+{
+	void *obj;
+
+	KASSERT(sl->sl_inuse == 0);
+
+	while (sl->sl_free != NULL) {
+		obj = sl->sl_free;
+		sl->sl_free = KC_LINK(kc, obj);
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(obj);
+		}
+	}
+	free_kpages((vaddr_t)sl);
+}
+
+/*
+ * Make a new slab for KC, with all its objects constructed and free.
+ * Called without the cache's lock. Returns NULL if out of memory or
+ * the constructor fails.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *sl;
+	vaddr_t page;
+	void *obj;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	sl = (struct kmem_slab *)page;
+	sl->sl_next = NULL;
+	sl->sl_prevp = NULL;
+	sl->sl_cache = kc;
+	sl->sl_free = NULL;
+	sl->sl_inuse = 0;
+
+	/* Backwards, so that the free list ends up in address order. */
+	for (i = kc->kc_perslab; i-- > 0; ) {
+		obj = (void *)(page + SL_OBJOFFSET + i * kc->kc_slotsize);
+		if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+			/* Undo the ones we did. */
+			slab_destroy(kc, sl);
+			return NULL;
+		}
+		KC_LINK(kc, obj) = sl->sl_free;
+		sl->sl_free = obj;
+	}
+	return sl;
+}
+
+/*
+ * Take a free object off the first partial slab, or failing that an
+ * empty one. Returns NULL if there are neither. Called with the
+ * cache's lock held.
+ */
+static
+void *
+kmem_cache_take(struct kmem_cache *kc)
+{
+	struct kmem_slab *sl;
+	bool wasempty;
+	void *obj;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	wasempty = false;
+	sl = kc->kc_partial;
+	if (sl == NULL) {
+		sl = kc->kc_empty;
+		if (sl == NULL) {
+			return NULL;
+		}
+		wasempty = true;
+		kc->kc_nempty--;
+	}
+
+	obj = sl->sl_free;
+	KASSERT(obj != NULL);
+	sl->sl_free = KC_LINK(kc, obj);
+	sl->sl_inuse++;
+	kc->kc_inuse++;
+
+	if (wasempty || sl->sl_inuse == kc->kc_perslab) {
+		slab_unlink(sl);
+		slab_link(sl->sl_inuse == kc->kc_perslab ?
+			  &kc->kc_full : &kc->kc_partial, sl);
+	}
+	return obj;
+}
+
+////////////////////////////////////////////////////////////
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+
+	kc->kc_size = size;
+	kc->kc_linkoff = ROUNDUP(size, sizeof(void *));
+	kc->kc_slotsize = ROUNDUP(kc->kc_linkoff + sizeof(void *), KMEM_ALIGN);
+	kc->kc_perslab = (PAGE_SIZE - SL_OBJOFFSET) / kc->kc_slotsize;
+	if (kc->kc_perslab < 2) {
+		panic("kmem_cache_create: %s: objects of %zu bytes are too big\n",
+		      name, size);
+	}
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_full = NULL;
+	kc->kc_empty = NULL;
+	kc->kc_nempty = 0;
+	kc->kc_nslabs = 0;
+	kc->kc_inuse = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_slab *sl;
+
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_partial == NULL);
+	KASSERT(kc->kc_full == NULL);
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	while (kc->kc_empty != NULL) {
+		sl = kc->kc_empty;
+		slab_unlink(sl);
+		slab_destroy(kc, sl);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc->kc_name);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *sl;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	obj = kmem_cache_take(kc);
+	spinlock_release(&kc->kc_lock);
+	if (obj != NULL) {
+		return obj;
+	}
+
+	sl = slab_create(kc);
+	if (sl == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	slab_link(&kc->kc_empty, sl);
+	kc->kc_nempty++;
+	kc->kc_nslabs++;
+	obj = kmem_cache_take(kc);
+	KASSERT(obj != NULL);
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *sl, *dead;
+	vaddr_t offset;
+	bool wasfull;
+
+	KASSERT(obj != NULL);
+	sl = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	offset = (vaddr_t)obj - (vaddr_t)sl;
+	if (sl->sl_cache != kc || offset < SL_OBJOFFSET ||
+	    (offset - SL_OBJOFFSET) % kc->kc_slotsize != 0) {
+		panic("kmem_cache_free: %p is not from cache %s\n",
+		      obj, kc->kc_name);
+	}
+
+	dead = NULL;
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(sl->sl_inuse > 0);
+	wasfull = sl->sl_inuse == kc->kc_perslab;
+	KC_LINK(kc, obj) = sl->sl_free;
+	sl->sl_free = obj;
+	sl->sl_inuse--;
+	kc->kc_inuse--;
+
+	if (sl->sl_inuse == 0) {
+		slab_unlink(sl);
+		if (kc->kc_nempty < KMEM_KEEPEMPTY) {
+			slab_link(&kc->kc_empty, sl);
+			kc->kc_nempty++;
+		}
+		else {
+			kc->kc_nslabs--;
+			dead = sl;
+		}
+	}
+	else if (wasfull) {
+		slab_unlink(sl);
+		slab_link(&kc->kc_partial, sl);
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/* Destructors run without the lock, like constructors. */
+	if (dead != NULL) {
+		slab_destroy(kc, dead);
+	}
+}
+
+void
+kmem_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kprintf("%-16s %6s %6s %8s %6s\n",
+		"cache", "size", "slot", "in use", "slabs");
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		kprintf("%-16s %6zu %6zu %8u %6u\n", kc->kc_name,
+			kc->kc_size, kc->kc_slotsize, kc->kc_inuse,
+			kc->kc_nslabs);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vm.h>
+
+/*
+ * Page cache for executable text and mmap'd files.
+ *
+ * Read-only pages of executables, and pages of files mapped with
+ * mmap, are shared between every address space mapping the same page
+ * of the same file. The cache maps
+ * (vnode, file offset) to a frame and holds one reference to the
+ * frame and one to the vnode per entry; each mapping holds another
+ * frame reference. A frame whose only reference is the cache's is
+ * mapped by nobody and can be reclaimed when memory is short, but
+ * until then a re-run of the same program finds its text resident.
+ * Since the entries' vnode references would otherwise keep removed
+ * files from being reclaimed and filesystems from being unmounted,
+ * unmapped pages are also dropped when a file's last open file table
+ * entry is closed, when it is removed, and before unmounting.
+ *
+ * Frames are read in without the lock held; if two faults race to
+ * fill the same page the loser frees its copy and uses the winner's.
+ * A write can also finish while a page is being read in, and then
+ * pagecache_update finds nothing to update. So each bucket has a
+ * generation number, which pagecache_update and pagecache_truncate
+ * bump for every page they cover; a fault that sees its bucket's
+ * generation change during the read reads the page again.
+ *
+ * MAP_SHARED mappings write straight into the cached frames, which
+ * reach the file on msync, munmap or exit. Writes through write()
+ * are copied into any cached page they touch by pagecache_update,
+ * and truncating a file (open with O_TRUNC) drops or zeroes its
+ * cached pages past the new end with pagecache_truncate, so cached
+ * pages follow changes made through the file system calls. Changes
+ * made to the file by other means are not seen.
+ */
+struct pc_entry {
+	struct vnode *pc_vnode;
+	off_t pc_offset;
+	paddr_t pc_paddr;
+	struct pc_entry *pc_next;
+};
+
+#define PC_NBUCKETS	256		/* power of 2 */
+
+static struct pc_entry *pc_buckets[PC_NBUCKETS];
+static unsigned pc_gen[PC_NBUCKETS];	/* bumped by writes; see above */
+static struct spinlock pc_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+pc_hash(struct vnode *v, off_t offset)
+{
+	uint32_t key;
+
+	key = ((uint32_t)v >> 5) ^ (uint32_t)(offset >> 12);
+	return ((key * 2654435761U) >> 24) & (PC_NBUCKETS - 1);
+}
+
+/*
+ * Find (V, OFFSET) in bucket B. Call with pc_lock held.
+ */
+static
+struct pc_entry *
+pc_find(unsigned b, struct vnode *v, off_t offset)
+{
+	struct pc_entry *pe;
+
+	for (pe = pc_buckets[b]; pe != NULL; pe = pe->pc_next) {
+		if (pe->pc_vnode == v && pe->pc_offset == offset) {
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+int
+pagecache_get(struct vnode *v, off_t offset, paddr_t *ret)
+{
+	struct pc_entry *pe, *newpe;
+	struct iovec iov;
+	struct uio u;
+	vaddr_t kva;
+	unsigned b, gen;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	b = pc_hash(v, offset);
+
+	spinlock_acquire(&pc_lock);
+	pe = pc_find(b, v, offset);
+	if (pe != NULL) {
+		frame_incref(pe->pc_paddr);
+		*ret = pe->pc_paddr;
+		spinlock_release(&pc_lock);
+		return 0;
+	}
+	gen = pc_gen[b];
+	spinlock_release(&pc_lock);
+
+	/* Miss: read the page in. */
+	newpe = kmalloc(sizeof(*newpe));
+	if (newpe == NULL) {
+		return ENOMEM;
+	}
+	kva = vm_allocpage();
+	if (kva == 0) {
+		kfree(newpe);
+		return ENOMEM;
+	}
+ reread:
+	uio_kinit(&iov, &u, (void *)kva, PAGE_SIZE, offset, UIO_READ);
+	result = VOP_READ(v, &u);
+	if (result) {
+		free_kpages(kva);
+		kfree(newpe);
+		return result;
+	}
+	/* Past EOF */
+	bzero((char *)kva + PAGE_SIZE - u.uio_resid, u.uio_resid);
+
+	spinlock_acquire(&pc_lock);
+	pe = pc_find(b, v, offset);
+	if (pe != NULL) {
+		/* Someone beat us to it. */
+		frame_incref(pe->pc_paddr);
+		*ret = pe->pc_paddr;
+		spinlock_release(&pc_lock);
+		free_kpages(kva);
+		kfree(newpe);
+		return 0;
+	}
+	if (pc_gen[b] != gen) {
+		/* A write may have missed what we read; again. */
+		gen = pc_gen[b];
+		spinlock_release(&pc_lock);
+		goto reread;
+	}
+	VOP_INCREF(v);
+	newpe->pc_vnode = v;
+	newpe->pc_offset = offset;
+	newpe->pc_paddr = KVADDR_TO_PADDR(kva);
+	newpe->pc_next = pc_buckets[b];
+	pc_buckets[b] = newpe;
+	/* One reference for the cache (from the allocation), one for us */
+	frame_incref(newpe->pc_paddr);
+	*ret = newpe->pc_paddr;
+	spinlock_release(&pc_lock);
+
+	return 0;
+}
+
+void
+pagecache_update(struct vnode *v, off_t start, off_t end)
+{
+	struct pc_entry *pe;
+	struct iovec iov;
+	struct uio u;
+	paddr_t paddr;
+	off_t page, from, to;
+	unsigned b;
+
+	for (page = start - start % PAGE_SIZE; page < end;
+	     page += PAGE_SIZE) {
+		b = pc_hash(v, page);
+		spinlock_acquire(&pc_lock);
+		pc_gen[b]++;
+		pe = pc_find(b, v, page);
+		if (pe == NULL) {
+			spinlock_release(&pc_lock);
+			continue;
+		}
+		/* Hold the frame while we read into it. */
+		paddr = pe->pc_paddr;
+		frame_incref(paddr);
+		spinlock_release(&pc_lock);
+
+		from = start > page ? start : page;
+		to = end < page + PAGE_SIZE ? end : page + PAGE_SIZE;
+		uio_kinit(&iov, &u,
+			  (char *)PADDR_TO_KVADDR(paddr) + (from - page),
+			  to - from, from, UIO_READ);
+		/* If this fails the page keeps what it had. */
+		(void)VOP_READ(v, &u);
+
+		frame_decref(paddr);
+	}
+}
+
+void
+pagecache_truncate(struct vnode *v, off_t size)
+{
+	struct pc_entry *pe, **pp, *victims;
+	off_t from;
+	unsigned b;
+
+	victims = NULL;
+
+	spinlock_acquire(&pc_lock);
+	for (b = 0; b < PC_NBUCKETS; b++) {
+		/* Any page of V past SIZE may be in any bucket. */
+		pc_gen[b]++;
+		pp = &pc_buckets[b];
+		while (*pp != NULL) {
+			pe = *pp;
+			if (pe->pc_vnode != v ||
+			    pe->pc_offset + PAGE_SIZE <= size) {
+				pp = &pe->pc_next;
+				continue;
+			}
+			if (pe->pc_offset >= size &&
+			    frame_refcount(pe->pc_paddr) == 1) {
+				/* Wholly past the end and unmapped */
+				*pp = pe->pc_next;
+				pe->pc_next = victims;
+				victims = pe;
+				continue;
+			}
+			/* Mapped, or straddling the end: zero the tail. */
+			from = size > pe->pc_offset ? size - pe->pc_offset : 0;
+			bzero((char *)PADDR_TO_KVADDR(pe->pc_paddr) + from,
+			      PAGE_SIZE - from);
+			pp = &pe->pc_next;
+		}
+	}
+	spinlock_release(&pc_lock);
+
+	while (victims != NULL) {
+		pe = victims;
+		victims = pe->pc_next;
+		frame_decref(pe->pc_paddr);
+		VOP_DECREF(pe->pc_vnode);
+		kfree(pe);
+	}
+}
+
+/*
+ * Drop every cached page of V, or of every vnode if V is NULL, that
+ * nobody has mapped. Returns how many were dropped.
+ */
+static
+unsigned
+pc_drop(struct vnode *v)
+{
+	struct pc_entry *pe, **pp, *victims;
+	unsigned b, count;
+
+	victims = NULL;
+	count = 0;
+
+	spinlock_acquire(&pc_lock);
+	for (b = 0; b < PC_NBUCKETS; b++) {
+		pp = &pc_buckets[b];
+		while (*pp != NULL) {
+			pe = *pp;
+			/*
+			 * Nobody can add a mapping without going
+			 * through pc_lock, so a count of one stays one.
+			 */
+			if ((v == NULL || pe->pc_vnode == v) &&
+			    frame_refcount(pe->pc_paddr) == 1) {
+				*pp = pe->pc_next;
+				pe->pc_next = victims;
+				victims = pe;
+				count++;
+			}
+			else {
+				pp = &pe->pc_next;
+			}
+		}
+	}
+	spinlock_release(&pc_lock);
+
+	/* Dropping vnode references can sleep, so do it unlocked. */
+	while (victims != NULL) {
+		pe = victims;
+		victims = pe->pc_next;
+		frame_decref(pe->pc_paddr);
+		VOP_DECREF(pe->pc_vnode);
+		kfree(pe);
+	}
+	return count;
+}
+
+void
+pagecache_purge(struct vnode *v)
+{
+	(void)pc_drop(v);
+}
+
+unsigned
+pagecache_reclaim(void)
+{
+	return pc_drop(NULL);
+}
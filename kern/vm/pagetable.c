@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/*
+ * Hashed page table.
+ *
+ * One table serves every address space. Entries are keyed on
+ * (address space, virtual page) and chained off an array of buckets
+ * sized to the number of physical frames, so the table's fixed cost
+ * grows with RAM rather than with the size of anyone's address space,
+ * and a TLB refill is one hash and a short chain walk.
+ *
+ * Each entry is also on its address space's as_ptes list, which is
+ * what pt_foreach and pt_cleanup walk; that list belongs to the
+ * address space and is protected by its as_lock. The bucket chains
+ * are shared between address spaces and protected by striped
+ * spinlocks. Entries never move once created, so a pte_t pointer
+ * handed out by pt_lookup/pt_insert stays good until pt_cleanup.
+ */
+struct hpt_entry {
+	struct addrspace *he_as;
+	vaddr_t he_vpage;
+	pte_t he_pte;
+	struct hpt_entry *he_next;	/* bucket chain */
+	struct hpt_entry *he_asnext;	/* as_ptes list */
+};
+
+#define HPT_NLOCKS	32		/* power of 2 */
+
+static struct hpt_entry **hpt_buckets;
+static unsigned hpt_shift;		/* log2 of the number of buckets */
+static struct spinlock hpt_locks[HPT_NLOCKS];
+
+static
+unsigned
+hpt_hash(struct addrspace *as, vaddr_t vpage)
+{
+	uint32_t key;
+
+	/* Fibonacci hashing: the top bits of the product are well mixed. */
+	key = (vpage >> 12) ^ ((uint32_t)as >> 5);
+	return (key * 2654435761U) >> (32 - hpt_shift);
+}
+
+#define HPT_LOCK(b)	(&hpt_locks[(b) & (HPT_NLOCKS - 1)])
+
+/*
+ * Find the entry for (AS, VPAGE) in bucket B. The bucket's lock must
+ * be held.
+ */
+static
+struct hpt_entry *
+hpt_find(unsigned b, struct addrspace *as, vaddr_t vpage)
+{
+	struct hpt_entry *he;
+
+	for (he = hpt_buckets[b]; he != NULL; he = he->he_next) {
+		if (he->he_as == as && he->he_vpage == vpage) {
+			return he;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Set up the table, with one bucket per physical frame (rounded up
+ * to a power of two). Called from vm_bootstrap.
+ */
+void
+pt_bootstrap(void)
+{
+	unsigned nframes, nbuckets, i;
+
+	nframes = ram_getsize() / PAGE_SIZE;
+	hpt_shift = 1;
+	while ((1U << hpt_shift) < nframes) {
+		hpt_shift++;
+	}
+	nbuckets = 1U << hpt_shift;
+
+	hpt_buckets = kmalloc(nbuckets * sizeof(struct hpt_entry *));
+	if (hpt_buckets == NULL) {
+		panic("vm: cannot allocate %u page table buckets\n", nbuckets);
+	}
+	for (i = 0; i < nbuckets; i++) {
+		hpt_buckets[i] = NULL;
+	}
+	for (i = 0; i < HPT_NLOCKS; i++) {
+		spinlock_init(&hpt_locks[i]);
+	}
+}
+
+int
+pt_init(struct addrspace *as)
+{
+	as->as_ptes = NULL;
+	return 0;
+}
+
+void
+pt_cleanup(struct addrspace *as)
+{
+	struct hpt_entry *he, **pp;
+	unsigned b;
+
+	while (as->as_ptes != NULL) {
+		he = as->as_ptes;
+		as->as_ptes = he->he_asnext;
+
+		b = hpt_hash(as, he->he_vpage);
+		spinlock_acquire(HPT_LOCK(b));
+		for (pp = &hpt_buckets[b]; *pp != he; pp = &(*pp)->he_next) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = he->he_next;
+		spinlock_release(HPT_LOCK(b));
+
+		kfree(he);
+	}
+}
+
+pte_t *
+pt_lookup(struct addrspace *as, vaddr_t vaddr)
+{
+	struct hpt_entry *he;
+	vaddr_t vpage;
+	unsigned b;
+
+	vpage = vaddr & PAGE_FRAME;
+	b = hpt_hash(as, vpage);
+
+	spinlock_acquire(HPT_LOCK(b));
+	he = hpt_find(b, as, vpage);
+	spinlock_release(HPT_LOCK(b));
+
+	return he == NULL ? NULL : &he->he_pte;
+}
+
+pte_t *
+pt_insert(struct addrspace *as, vaddr_t vaddr)
+{
+	struct hpt_entry *he;
+	vaddr_t vpage;
+	unsigned b;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	vpage = vaddr & PAGE_FRAME;
+	b = hpt_hash(as, vpage);
+
+	spinlock_acquire(HPT_LOCK(b));
+	he = hpt_find(b, as, vpage);
+	spinlock_release(HPT_LOCK(b));
+	if (he != NULL) {
+		return &he->he_pte;
+	}
+
+	/*
+	 * Nobody else inserts for AS (we hold its as_lock), so the
+	 * entry can't have appeared while the lock was dropped.
+	 */
+	he = kmalloc(sizeof(struct hpt_entry));
+	if (he == NULL) {
+		return NULL;
+	}
+	he->he_as = as;
+	he->he_vpage = vpage;
+	he->he_pte = 0;
+	he->he_asnext = as->as_ptes;
+	as->as_ptes = he;
+
+	spinlock_acquire(HPT_LOCK(b));
+	he->he_next = hpt_buckets[b];
+	hpt_buckets[b] = he;
+	spinlock_release(HPT_LOCK(b));
+
+	return &he->he_pte;
+}
+
+int
+pt_foreach(struct addrspace *as,
+	   int (*func)(vaddr_t vpage, pte_t *pte, void *arg), void *arg)
+{
+	struct hpt_entry *he;
+	int result;
+
+	for (he = as->as_ptes; he != NULL; he = he->he_asnext) {
+		if (he->he_pte == 0) {
+			continue;
+		}
+		result = func(he->he_vpage, &he->he_pte, arg);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+void
+pt_update(struct addrspace *as, vaddr_t vpage, pte_t *pte, pte_t newpte)
+{
+	unsigned b;
+
+	b = hpt_hash(as, vpage & PAGE_FRAME);
+	spinlock_acquire(HPT_LOCK(b));
+	*pte = newpte;
+	spinlock_release(HPT_LOCK(b));
+}
+
+/*
+ * TLB refill fast path: if (AS, VPAGE) is resident and the access is
+ * allowed by the PTE alone, mark it referenced, load the TLB and
+ * return true. Clean pages are loaded read-only, so that the first
+ * write goes through vm_fault and sets PTE_DIRTY. This takes neither
+ * as_lock nor the region list. The bucket lock is held across the
+ * TLB write so that anyone who clears the PTE and then flushes the
+ * TLB can't be overtaken by a refill of the old translation. (Holding
+ * it also keeps us on this CPU while we count the refill.)
+ */
+bool
+pt_refill(struct addrspace *as, vaddr_t vpage, bool write)
+{
+	struct hpt_entry *he;
+	unsigned b;
+	pte_t pte;
+	bool writable;
+
+	b = hpt_hash(as, vpage);
+
+	spinlock_acquire(HPT_LOCK(b));
+	he = hpt_find(b, as, vpage);
+	if (he == NULL) {
+		spinlock_release(HPT_LOCK(b));
+		return false;
+	}
+	pte = he->he_pte;
+	writable = (pte & (PTE_WRITE | PTE_DIRTY)) == (PTE_WRITE | PTE_DIRTY);
+	if ((pte & PTE_VALID) == 0 || (write && !writable)) {
+		spinlock_release(HPT_LOCK(b));
+		return false;
+	}
+	he->he_pte = pte | PTE_REF;
+	vm_tlbload(vpage, (pte & PTE_FRAME) | TLBLO_VALID |
+		   (writable ? TLBLO_DIRTY : 0));
+	curcpu->c_tlbstats.tlbs_refills++;
+	spinlock_release(HPT_LOCK(b));
+	return true;
+}
+
+/*
+ * Load the other resident pages of VPAGE's cluster into empty TLB
+ * slots, so that walking through the cluster takes one miss rather
+ * than one per page. Each is loaded the way pt_refill would, under
+ * its own bucket lock, and marked referenced. We stop as soon as the
+ * TLB is full: evicting live entries for pages that may never be
+ * touched would be a loss.
+ */
+void
+pt_prefetch(struct addrspace *as, vaddr_t vpage)
+{
+	struct hpt_entry *he;
+	vaddr_t base, npage;
+	unsigned b, i;
+	pte_t pte;
+	bool writable, more;
+
+	/* Only a hint, as we may move CPU; vm_tlbprefetch checks again. */
+	if (curcpu->c_tlbfree >= NUM_TLB) {
+		return;
+	}
+
+	base = vpage & ~(vaddr_t)(VM_CLUSTER * PAGE_SIZE - 1);
+	more = true;
+	for (i = 0; i < VM_CLUSTER && more; i++) {
+		npage = base + i * PAGE_SIZE;
+		if (npage == vpage) {
+			continue;
+		}
+		b = hpt_hash(as, npage);
+
+		spinlock_acquire(HPT_LOCK(b));
+		he = hpt_find(b, as, npage);
+		if (he != NULL && (he->he_pte & PTE_VALID)) {
+			pte = he->he_pte;
+			writable = (pte & (PTE_WRITE | PTE_DIRTY)) ==
+				(PTE_WRITE | PTE_DIRTY);
+			more = vm_tlbprefetch(npage, (pte & PTE_FRAME) |
+					      TLBLO_VALID |
+					      (writable ? TLBLO_DIRTY : 0));
+			if (more) {
+				he->he_pte = pte | PTE_REF;
+			}
+		}
+		spinlock_release(HPT_LOCK(b));
+	}
+}
@@ -0,0 +1,722 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <synch.h>
+#include <thread.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+
+/*
+ * Swap.
+ *
+ * The swap disk is divided into page-sized slots, tracked by a bitmap
+ * and a reference count per slot (a slot is shared after fork until
+ * one side reads it back in). A swapped-out PTE holds its slot number
+ * in place of the frame. A page read back in keeps its slot as a
+ * clean copy, recorded per frame in swap_frames, until it is written
+ * (PTE_DIRTY), so if it is paged out again unchanged no write is
+ * needed.
+ *
+ * Page replacement is WSClock with aging, run by the pager thread
+ * over the frame table (frame_clocknext). Each time the hand passes a
+ * page its age is shifted right, with SWAP_AGE_NEW or'd in if it was
+ * referenced (PTE_REF, set on TLB refill) since the last time. A page
+ * whose age has reached zero has gone unused for several turns and is
+ * out of its process's working set: if it is clean it is evicted, and
+ * if dirty it is written to swap but left in memory ("pre-cleaned"),
+ * to be evicted without I/O next time round if still unused.
+ *
+ * The pager wakes when free memory falls below swap_lowater
+ * (swap_kick, from vm_allocpage) and works until it is back above
+ * swap_hiwater, so faults shouldn't normally have to wait for it. A
+ * fault that finds no memory at all calls swap_reclaim, which asks
+ * for an urgent pass: that one ignores age, evicting any page not
+ * referenced since the hand last passed and writing out dirty ones
+ * on the spot.
+ *
+ * A pass collects up to SWAP_BATCH pages. Pages to be evicted are
+ * unmapped and marked PTE_BUSY, pages to be cleaned lose PTE_DIRTY.
+ * Then every TLB is flushed once for the whole batch, and the pages
+ * that need it are written out, each run of consecutive slots in a
+ * single multi-sector write to the disk.
+ *
+ * The pager holds swap_lock while it picks the batch and while it
+ * finishes off each run of it, but not across the writes, so only
+ * the processes whose pages are in the batch ever wait for the disk.
+ * Each address space counts its pages in the batch in as_npaging
+ * (under swap_lock), and a page stays PTE_BUSY, or in the SV_CLEAN
+ * case mapped but still being copied, until its run is finished. A
+ * fault on a PTE_BUSY entry drops its as_lock and waits for its
+ * address space's count to drop to zero (swap_wait). as_copy,
+ * as_destroy and the others that free or share pages wait for the
+ * same thing and then keep swap_lock while they walk the page table
+ * (swap_pause), so they never see a page in a batch. The same rule
+ * keeps an address space from being destroyed while a pass is using
+ * it. That is not enough by itself to make the owner
+ * the clock reports safe to look at: a frame names its owner from
+ * before the pass, so anyone dropping a page's frame (as_free_page,
+ * vm_cowbreak) must frame_disown it first, and a frame whose owner
+ * has gone away then has none. The pager only ever try-locks an address
+ * space, so it can't deadlock with a faulting process that holds its
+ * own as_lock and is waiting on something the pager's caller holds.
+ */
+
+#define SWAP_DEVICE	"lhd0"
+#define SWAP_BATCH	16		/* pages written per pass */
+#define SWAP_AGE_TURNS	4		/* unreferenced turns until idle */
+#define SWAP_AGE_NEW	(1 << (SWAP_AGE_TURNS - 1))
+#define SWAP_LOWATER	32		/* wake the pager below 1/32 of RAM free */
+#define SWAP_HIWATER	16		/* until 1/16 of RAM is free */
+#define NO_SLOT		0xffffffff
+
+static struct vnode *swap_vnode;	/* NULL when running without swap */
+static unsigned swap_nslots;
+static unsigned swap_nused;		/* slots in use */
+static struct bitmap *swap_map;		/* slots in use */
+static uint16_t *swap_refs;		/* references to each slot */
+
+/*
+ * Per frame, indexed by frame number: the slot holding a clean copy
+ * of the page in it, if any, and the page's age.
+ */
+struct swap_frame {
+	uint32_t sf_slot;
+	uint8_t sf_age;
+};
+static struct swap_frame *swap_frames;
+
+/* Protects swap_map, swap_refs, swap_nused, sf_slot and swap_kicked. */
+static struct spinlock swap_maplock;
+
+static unsigned swap_lowater, swap_hiwater;	/* in frames */
+static struct semaphore *swap_kicksem;		/* wakes the pager */
+static bool swap_kicked;
+
+static struct lock *swap_lock;
+static struct cv *swap_donecv;		/* swap_reclaim waits for a pass */
+static struct cv *swap_busycv;		/* some as_npaging went down */
+static bool swap_wanted;		/* an urgent pass is wanted */
+static unsigned swap_urgent;		/* urgent passes done */
+static unsigned swap_freed;		/* frames freed by the last one */
+
+/* Statistics, under swap_lock except for swap_nin (swap_maplock). */
+static unsigned swap_npasses;
+static unsigned swap_nclean;		/* clean pages evicted */
+static unsigned swap_nout;		/* dirty pages written and evicted */
+static unsigned swap_nprecleaned;	/* dirty pages written, kept */
+static unsigned swap_nreclaim;		/* faults that waited for memory */
+static unsigned swap_nin;		/* pages read back in */
+
+/* What a pass is doing with a page */
+#define SV_EVICT	0		/* clean: just drop it */
+#define SV_PAGEOUT	1		/* write it out, then drop it */
+#define SV_CLEAN	2		/* write it out and keep it */
+
+struct swap_victim {
+	int sv_what;
+	struct addrspace *sv_as;
+	vaddr_t sv_vpage;
+	pte_t *sv_pte;
+	pte_t sv_oldpte;
+	paddr_t sv_paddr;
+	unsigned sv_slot;
+};
+
+static
+int
+swap_slotalloc(unsigned *slot)
+{
+	int result;
+
+	spinlock_acquire(&swap_maplock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_refs[*slot] = 1;
+		swap_nused++;
+	}
+	spinlock_release(&swap_maplock);
+	return result;
+}
+
+/* Call with swap_maplock held. */
+static
+void
+swap_decref(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+	KASSERT(swap_refs[slot] > 0);
+
+	if (--swap_refs[slot] == 0) {
+		bitmap_unmark(swap_map, slot);
+		swap_nused--;
+	}
+}
+
+void
+swap_share(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_maplock);
+	KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_maplock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	spinlock_acquire(&swap_maplock);
+	swap_decref(slot);
+	spinlock_release(&swap_maplock);
+}
+
+void
+swap_dropcopy(paddr_t paddr)
+{
+	struct swap_frame *sf;
+
+	if (swap_vnode == NULL) {
+		return;
+	}
+
+	sf = &swap_frames[paddr / PAGE_SIZE];
+	spinlock_acquire(&swap_maplock);
+	if (sf->sf_slot != NO_SLOT) {
+		swap_decref(sf->sf_slot);
+		sf->sf_slot = NO_SLOT;
+	}
+	spinlock_release(&swap_maplock);
+}
+
+int
+swap_in(unsigned slot, vaddr_t kpage)
+{
+	struct swap_frame *sf;
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &u, (void *)kpage, PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+
+	sf = &swap_frames[KVADDR_TO_PADDR(kpage) / PAGE_SIZE];
+	spinlock_acquire(&swap_maplock);
+	KASSERT(sf->sf_slot == NO_SLOT);
+	sf->sf_slot = slot;
+	sf->sf_age = SWAP_AGE_NEW;
+	swap_nin++;
+	spinlock_release(&swap_maplock);
+	return 0;
+}
+
+/*
+ * Write the pages of SV[0..N-1], which are in consecutive slots, with
+ * one request to the disk.
+ */
+static
+int
+swap_write(struct swap_victim *sv, unsigned n)
+{
+	struct iovec iov[SWAP_BATCH];
+	struct uio u;
+	unsigned i;
+
+	KASSERT(n > 0 && n <= SWAP_BATCH);
+
+	for (i = 0; i < n; i++) {
+		KASSERT(sv[i].sv_slot == sv[0].sv_slot + i);
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(sv[i].sv_paddr);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = n;
+	u.uio_offset = (off_t)sv[0].sv_slot * PAGE_SIZE;
+	u.uio_resid = n * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = UIO_WRITE;
+	u.uio_space = NULL;
+
+	return VOP_WRITE(swap_vnode, &u);
+}
+
+/*
+ * Look at the page under the clock hand and, if something is to be
+ * done with it, set that up and add it to BATCH. Returns nonzero if
+ * there is no swap space left.
+ */
+static
+int
+swap_consider(struct swap_victim *batch, unsigned *n, bool urgent,
+	      bool *cleared)
+{
+	struct swap_victim *sv;
+	struct swap_frame *sf;
+	struct addrspace *as;
+	vaddr_t vpage;
+	paddr_t paddr;
+	pte_t *pte;
+	int result = 0;
+
+	paddr = frame_clocknext(&as, &vpage);
+	if (paddr == 0) {
+		return 0;
+	}
+	if (!lock_tryacquire(as->as_lock)) {
+		/* Busy faulting or forking: leave it be. */
+		return 0;
+	}
+
+	pte = pt_lookup(as, vpage);
+	if (pte == NULL || (*pte & PTE_VALID) == 0 ||
+	    (*pte & PTE_FRAME) != paddr || frame_refcount(paddr) != 1) {
+		/* The owner hint was stale. */
+		goto done;
+	}
+
+	sf = &swap_frames[paddr / PAGE_SIZE];
+	if (*pte & PTE_REF) {
+		pt_update(as, vpage, pte, *pte & ~PTE_REF);
+		sf->sf_age = (sf->sf_age >> 1) | SWAP_AGE_NEW;
+		*cleared = true;
+		goto done;
+	}
+	sf->sf_age >>= 1;
+	if (sf->sf_age != 0 && !urgent) {
+		/* Still in the working set */
+		goto done;
+	}
+
+	sv = &batch[*n];
+	sv->sv_as = as;
+	sv->sv_vpage = vpage;
+	sv->sv_pte = pte;
+	sv->sv_oldpte = *pte;
+	sv->sv_paddr = paddr;
+
+	/* sf_slot can't change under us while we hold as_lock. */
+	if ((*pte & PTE_DIRTY) == 0 && sf->sf_slot != NO_SLOT) {
+		/* The clean copy's reference passes to the PTE. */
+		sv->sv_what = SV_EVICT;
+		sv->sv_slot = sf->sf_slot;
+		spinlock_acquire(&swap_maplock);
+		sf->sf_slot = NO_SLOT;
+		spinlock_release(&swap_maplock);
+		pt_update(as, vpage, pte, SLOT_PTE(sv->sv_slot) | PTE_BUSY);
+		as->as_npaging++;
+		(*n)++;
+		goto done;
+	}
+
+	result = swap_slotalloc(&sv->sv_slot);
+	if (result) {
+		goto done;
+	}
+	if (urgent) {
+		sv->sv_what = SV_PAGEOUT;
+		pt_update(as, vpage, pte, SLOT_PTE(sv->sv_slot) | PTE_BUSY);
+	}
+	else {
+		/*
+		 * The frame gets a second reference to the slot as its
+		 * clean copy, which a write before we're done drops.
+		 */
+		sv->sv_what = SV_CLEAN;
+		spinlock_acquire(&swap_maplock);
+		KASSERT(sf->sf_slot == NO_SLOT);
+		sf->sf_slot = sv->sv_slot;
+		swap_refs[sv->sv_slot]++;
+		spinlock_release(&swap_maplock);
+		pt_update(as, vpage, pte, *pte & ~PTE_DIRTY);
+	}
+	as->as_npaging++;
+	(*n)++;
+
+ done:
+	lock_release(as->as_lock);
+	return result;
+}
+
+/*
+ * Finish off one page of a pass, whose write (if it had one) returned
+ * RESULT. The PTEs of evicted pages are still PTE_BUSY, so nobody else
+ * will touch them and they can be updated without the as_lock.
+ * Returns true if the frame was freed.
+ */
+static
+bool
+swap_finish(struct swap_victim *sv, int result)
+{
+	switch (sv->sv_what) {
+	    case SV_PAGEOUT:
+		if (result) {
+			pt_update(sv->sv_as, sv->sv_vpage, sv->sv_pte,
+				  sv->sv_oldpte);
+			swap_free(sv->sv_slot);
+			return false;
+		}
+		swap_nout++;
+		break;
+	    case SV_CLEAN:
+		if (result) {
+			/* Stays dirty as far as eviction is concerned */
+			swap_dropcopy(sv->sv_paddr);
+		}
+		else {
+			swap_nprecleaned++;
+		}
+		swap_free(sv->sv_slot);
+		return false;
+	    case SV_EVICT:
+		swap_nclean++;
+		break;
+	}
+
+	pt_update(sv->sv_as, sv->sv_vpage, sv->sv_pte, SLOT_PTE(sv->sv_slot));
+	frame_decref(sv->sv_paddr);
+	return true;
+}
+
+/*
+ * One pass of the pager. Returns the number of frames freed, and in
+ * *CLEANED the number of pages pre-cleaned. Called with swap_lock
+ * held, which is dropped across the writes.
+ */
+static
+unsigned
+swap_pageout(bool urgent, unsigned *cleaned)
+{
+	struct swap_victim batch[SWAP_BATCH], tmp;
+	unsigned i, j, n, run, nframes, freed, oldclean;
+	bool cleared;
+	int result, spl;
+
+	KASSERT(lock_do_i_hold(swap_lock));
+
+	/*
+	 * At most two turns of the clock in an urgent pass, since the
+	 * first may do no more than clear reference bits. Otherwise
+	 * one turn; aging takes several anyway.
+	 */
+	nframes = ram_getsize() / PAGE_SIZE;
+	if (urgent) {
+		nframes *= 2;
+	}
+	n = 0;
+	cleared = false;
+	for (i = 0; i < nframes && n < SWAP_BATCH; i++) {
+		if (swap_consider(batch, &n, urgent, &cleared)) {
+			break;
+		}
+	}
+
+	/*
+	 * Nobody may go on writing to a page while it is being copied
+	 * out, and pages whose reference bit was cleared have to fault
+	 * again to set it.
+	 */
+	if (n > 0 || cleared) {
+		vm_tlbinvalidate(TLBSHOOTDOWN_ALL);
+	}
+
+	/* Sort by slot, to find the runs. */
+	for (i = 1; i < n; i++) {
+		tmp = batch[i];
+		for (j = i; j > 0 && batch[j-1].sv_slot > tmp.sv_slot; j--) {
+			batch[j] = batch[j-1];
+		}
+		batch[j] = tmp;
+	}
+
+	oldclean = swap_nprecleaned;
+	freed = 0;
+	if (n > 0) {
+		lock_release(swap_lock);
+	}
+	for (i = 0; i < n; i += run) {
+		run = 1;
+		result = 0;
+		if (batch[i].sv_what != SV_EVICT) {
+			while (i + run < n &&
+			       batch[i + run].sv_what != SV_EVICT &&
+			       batch[i + run].sv_slot == batch[i].sv_slot + run) {
+				run++;
+			}
+			result = swap_write(&batch[i], run);
+			if (result) {
+				kprintf("swap: write error: %s\n",
+					strerror(result));
+			}
+		}
+
+		/* Free on this CPU, then hand the frames on. */
+		lock_acquire(swap_lock);
+		spl = splhigh();
+		for (j = i; j < i + run; j++) {
+			if (swap_finish(&batch[j], result)) {
+				freed++;
+			}
+			batch[j].sv_as->as_npaging--;
+		}
+		framecache_flush();
+		splx(spl);
+		cv_broadcast(swap_busycv, swap_lock);
+		if (i + run < n) {
+			lock_release(swap_lock);
+		}
+	}
+
+	swap_npasses++;
+	*cleaned = swap_nprecleaned - oldclean;
+	return freed;
+}
+
+/*
+ * The pager thread. It runs passes while an urgent one is wanted or
+ * free memory is below the high watermark, then sleeps until kicked
+ * again. It also stops if SWAP_AGE_TURNS passes in a row get nowhere:
+ * by then every page has been seen to be in use.
+ */
+static
+void
+swap_pager(void *data1, unsigned long data2)
+{
+	unsigned freed, cleaned, idle;
+	bool urgent;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		P(swap_kicksem);
+
+		lock_acquire(swap_lock);
+		idle = 0;
+		while (swap_wanted ||
+		       (frame_freecount() < swap_hiwater &&
+			idle < SWAP_AGE_TURNS)) {
+			urgent = swap_wanted;
+			swap_wanted = false;
+			freed = swap_pageout(urgent, &cleaned);
+			if (urgent) {
+				swap_freed = freed;
+				swap_urgent++;
+				cv_broadcast(swap_donecv, swap_lock);
+			}
+			idle = (freed == 0 && cleaned == 0) ? idle + 1 : 0;
+
+			/* Let waiting forks and exits in between passes. */
+			lock_release(swap_lock);
+			lock_acquire(swap_lock);
+		}
+
+		spinlock_acquire(&swap_maplock);
+		swap_kicked = false;
+		spinlock_release(&swap_maplock);
+
+		lock_release(swap_lock);
+	}
+}
+
+void
+swap_kick(void)
+{
+	bool kick;
+
+	if (swap_vnode == NULL || frame_freecount() >= swap_lowater) {
+		return;
+	}
+
+	spinlock_acquire(&swap_maplock);
+	kick = !swap_kicked;
+	swap_kicked = true;
+	spinlock_release(&swap_maplock);
+
+	if (kick) {
+		V(swap_kicksem);
+	}
+}
+
+bool
+swap_reclaim(void)
+{
+	unsigned pass;
+	bool ret;
+
+	if (swap_vnode == NULL) {
+		return false;
+	}
+
+	lock_acquire(swap_lock);
+	swap_nreclaim++;
+	pass = swap_urgent;
+	if (!swap_wanted) {
+		swap_wanted = true;
+		V(swap_kicksem);
+	}
+	while (swap_urgent == pass) {
+		cv_wait(swap_donecv, swap_lock);
+	}
+	ret = swap_freed > 0;
+	lock_release(swap_lock);
+
+	return ret;
+}
+
+void
+swap_pause(struct addrspace *as)
+{
+	lock_acquire(swap_lock);
+	while (as->as_npaging > 0) {
+		cv_wait(swap_busycv, swap_lock);
+	}
+}
+
+void
+swap_wait(struct addrspace *as)
+{
+	swap_pause(as);
+	lock_release(swap_lock);
+}
+
+void
+swap_resume(void)
+{
+	lock_release(swap_lock);
+}
+
+void
+swap_printstats(void)
+{
+	kprintf("vm: %u frames free; pager low/high water %u/%u\n",
+		frame_freecount(), swap_lowater, swap_hiwater);
+	if (swap_vnode == NULL) {
+		kprintf("vm: no swap\n");
+		return;
+	}
+
+	lock_acquire(swap_lock);
+	kprintf("vm: swap %u/%u slots in use\n", swap_nused, swap_nslots);
+	kprintf("vm: %u pager passes, %u urgent; %u faults waited\n",
+		swap_npasses, swap_urgent, swap_nreclaim);
+	kprintf("vm: evicted %u clean, %u after writing; "
+		"%u pre-cleaned\n", swap_nclean, swap_nout, swap_nprecleaned);
+	kprintf("vm: %u pages read from swap\n", swap_nin);
+	lock_release(swap_lock);
+}
+
+/*
+ * Attach the swap disk and start the pager. Called from vm_bootstrap,
+ * after the devices have been probed.
+ */
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	unsigned i, nframes;
+	int result;
+
+	nframes = ram_getsize() / PAGE_SIZE;
+	swap_lowater = nframes / SWAP_LOWATER;
+	swap_hiwater = nframes / SWAP_HIWATER;
+
+	swap_lock = lock_create("swap");
+	swap_donecv = cv_create("swapdone");
+	swap_busycv = cv_create("swapbusy");
+	swap_kicksem = sem_create("swapkick", 0);
+	if (swap_lock == NULL || swap_donecv == NULL || swap_busycv == NULL ||
+	    swap_kicksem == NULL) {
+		panic("swap: cannot create synchronization primitives\n");
+	}
+	spinlock_init(&swap_maplock);
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n",
+		      SWAP_DEVICE, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; running without swap\n",
+			SWAP_DEVICE);
+		VOP_DECREF(swap_vnode);
+		vfs_swapoff(SWAP_DEVICE);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_refs = kmalloc(swap_nslots * sizeof(uint16_t));
+	swap_frames = kmalloc(nframes * sizeof(struct swap_frame));
+	if (swap_map == NULL || swap_refs == NULL || swap_frames == NULL) {
+		panic("swap: cannot allocate map for %u slots\n", swap_nslots);
+	}
+	for (i = 0; i < swap_nslots; i++) {
+		swap_refs[i] = 0;
+	}
+	for (i = 0; i < nframes; i++) {
+		swap_frames[i].sf_slot = NO_SLOT;
+		swap_frames[i].sf_age = 0;
+	}
+
+	result = thread_fork("pager", NULL, swap_pager, NULL, 0);
+	if (result) {
+		panic("swap: thread_fork failed: %s\n", strerror(result));
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/*
+ * Paged VM system. Used instead of dumbvm when "options dumbvm" is
+ * not in the kernel config.
+ *
+ * User pages are allocated on first touch, zeroed or read in from the
+ * executable, and recorded in the page table; the TLB is a cache of the page
+ * table refilled on every miss, using a random slot when it is full.
+ * Both are done a cluster (VM_CLUSTER pages) at a time where possible.
+ * When memory runs out, the swap daemon (swap.c) pages some out and
+ * the fault is retried.
+ */
+
+/* Serializes vm_tlbinvalidate, which waits on vm_shootdown_sem. */
+static struct lock *vm_shootdown_lock;
+static struct semaphore *vm_shootdown_sem;
+
+void
+vm_bootstrap(void)
+{
+	pt_bootstrap();
+
+	vm_shootdown_lock = lock_create("vm_shootdown");
+	vm_shootdown_sem = sem_create("vm_shootdown", 0);
+	if (vm_shootdown_lock == NULL || vm_shootdown_sem == NULL) {
+		panic("vm: cannot create shootdown lock\n");
+	}
+
+	swap_bootstrap();
+}
+
+/*
+ * Invalidate every entry of this CPU's TLB.
+ */
+void
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlbfree = 0;
+	curcpu->c_tlbstats.tlbs_flushes++;
+	splx(spl);
+}
+
+/*
+ * Invalidate VPAGE (or everything) in this CPU's TLB.
+ */
+static
+void
+vm_tlbdrop(vaddr_t vpage)
+{
+	int spl, index;
+
+	if (vpage == TLBSHOOTDOWN_ALL) {
+		vm_tlbflush();
+		return;
+	}
+
+	spl = splhigh();
+	index = tlb_probe(vpage, 0);
+	if (index >= 0) {
+		tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+		if ((unsigned)index < curcpu->c_tlbfree) {
+			curcpu->c_tlbfree = index;
+		}
+	}
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	/* Called from the IPI handler, so already at splhigh */
+	curcpu->c_tlbstats.tlbs_shootdowns++;
+	vm_tlbdrop(ts->ts_vaddr);
+	V(ts->ts_done);
+}
+
+/*
+ * We don't use ASIDs, so VPAGE is dropped from every CPU whatever
+ * it is running; that is never wrong, just sometimes unnecessary.
+ */
+void
+vm_tlbinvalidate(vaddr_t vpage)
+{
+	struct tlbshootdown ts;
+	struct cpu *c;
+	unsigned i, n;
+	int spl;
+
+	ts.ts_vaddr = vpage;
+	ts.ts_done = vm_shootdown_sem;
+
+	lock_acquire(vm_shootdown_lock);
+
+	/* Stay on this CPU until we've picked the others and done ours. */
+	spl = splhigh();
+	n = 0;
+	for (i = 0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, &ts);
+			n++;
+		}
+	}
+	vm_tlbdrop(vpage);
+	splx(spl);
+
+	while (n-- > 0) {
+		P(vm_shootdown_sem);
+	}
+
+	lock_release(vm_shootdown_lock);
+}
+
+/*
+ * Find an empty slot in this CPU's TLB, or return -1. Every slot
+ * below c_tlbfree is in use, so after a flush this only ever looks
+ * at each slot once. Called at splhigh.
+ */
+static
+int
+vm_tlbfreeslot(void)
+{
+	uint32_t ehi, elo;
+	unsigned i;
+
+	while (curcpu->c_tlbfree < NUM_TLB) {
+		i = curcpu->c_tlbfree++;
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Load a translation into the TLB, replacing any existing entry for
+ * the same page (as is the case on a VM_FAULT_READONLY), else into an
+ * empty slot, and only when there are none letting the hardware pick
+ * a random victim slot.
+ */
+void
+vm_tlbload(vaddr_t vpage, uint32_t elo)
+{
+	int spl, index;
+
+	spl = splhigh();
+	index = tlb_probe(vpage, 0);
+	if (index < 0) {
+		index = vm_tlbfreeslot();
+	}
+	if (index >= 0) {
+		tlb_write(vpage, elo, index);
+	}
+	else {
+		tlb_random(vpage, elo);
+	}
+	splx(spl);
+}
+
+/*
+ * Load a translation the way vm_tlbload does, but only into an empty
+ * slot, never evicting anything. Returns false if the TLB is full.
+ */
+bool
+vm_tlbprefetch(vaddr_t vpage, uint32_t elo)
+{
+	int spl, index;
+
+	spl = splhigh();
+	if (tlb_probe(vpage, 0) >= 0) {
+		splx(spl);
+		return true;
+	}
+	index = vm_tlbfreeslot();
+	if (index >= 0) {
+		tlb_write(vpage, elo, index);
+		curcpu->c_tlbstats.tlbs_prefetches++;
+	}
+	splx(spl);
+	return index >= 0;
+}
+
+vaddr_t
+vm_allocpage(void)
+{
+	vaddr_t kva;
+
+	kva = alloc_kpages(1);
+	if (kva == 0 && (pagecache_reclaim() > 0 || kheap_reclaim() > 0)) {
+		kva = alloc_kpages(1);
+	}
+	swap_kick();
+	return kva;
+}
+
+/*
+ * First touch of VPAGE, which as_cluster says is in a cluster worth
+ * populating whole: if nothing else in the cluster has been touched
+ * yet either, give all of it frames from one aligned run, filled in
+ * as vm_pagein would. Returns an error, having mapped nothing, if
+ * that can't be done; the caller then falls back to a single page.
+ */
+static
+int
+vm_pagein_cluster(struct addrspace *as, vaddr_t vpage)
+{
+	pte_t *ptes[VM_CLUSTER];
+	vaddr_t base, kva;
+	paddr_t paddr;
+	unsigned i, j;
+	int result;
+
+	base = vpage & ~(vaddr_t)(VM_CLUSTER * PAGE_SIZE - 1);
+	for (i = 0; i < VM_CLUSTER; i++) {
+		ptes[i] = pt_insert(as, base + i * PAGE_SIZE);
+		if (ptes[i] == NULL) {
+			return ENOMEM;
+		}
+		if (*ptes[i] != 0) {
+			return EEXIST;
+		}
+	}
+
+	paddr = frame_allocrun(VM_CLUSTERORDER);
+	swap_kick();
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	for (i = 0; i < VM_CLUSTER; i++) {
+		kva = PADDR_TO_KVADDR(paddr + i * PAGE_SIZE);
+		bzero((void *)kva, PAGE_SIZE);
+		result = as_fill_page(as, base + i * PAGE_SIZE, kva);
+		if (result) {
+			for (j = 0; j < VM_CLUSTER; j++) {
+				free_kpages(PADDR_TO_KVADDR(paddr +
+							    j * PAGE_SIZE));
+			}
+			return result;
+		}
+	}
+
+	for (i = 0; i < VM_CLUSTER; i++) {
+		frame_setowner(paddr + i * PAGE_SIZE, as, base + i * PAGE_SIZE);
+		*ptes[i] = (paddr + i * PAGE_SIZE) |
+			PTE_VALID | PTE_WRITE | PTE_DIRTY;
+	}
+	return 0;
+}
+
+/*
+ * Give the empty PTE for VPAGE a frame, zeroed and with any file data
+ * for the page read in, or read back from swap if it was paged out.
+ * Whole pages of read-only text come from the shared page cache
+ * instead, as do mmap'd pages: MAP_SHARED ones writable in place,
+ * private ones copy-on-write. Shared anonymous pages belong to no one
+ * address space, so the pager leaves them be. Only a page read from
+ * swap starts out clean. In big private regions the rest of the
+ * page's cluster may be given frames along with it.
+ */
+static
+int
+vm_pagein(struct addrspace *as, vaddr_t vpage, pte_t *pte)
+{
+	struct vnode *v;
+	off_t offset;
+	paddr_t paddr;
+	vaddr_t kva;
+	bool shared;
+	int result;
+
+	if (*pte & PTE_SWAPPED) {
+		kva = vm_allocpage();
+		if (kva == 0) {
+			return ENOMEM;
+		}
+		result = swap_in(PTE_SLOT(*pte), kva);
+		if (result) {
+			free_kpages(kva);
+			return result;
+		}
+		frame_setowner(KVADDR_TO_PADDR(kva), as, vpage);
+		*pte = KVADDR_TO_PADDR(kva) | PTE_VALID;
+		return 0;
+	}
+
+	if (as_mapped_page(as, vpage, &v, &offset, &shared)) {
+		if (v == NULL) {
+			kva = vm_allocpage();
+			if (kva == 0) {
+				return ENOMEM;
+			}
+			bzero((void *)kva, PAGE_SIZE);
+			*pte = KVADDR_TO_PADDR(kva) |
+				PTE_VALID | PTE_SHARED | PTE_DIRTY;
+			return 0;
+		}
+		result = pagecache_get(v, offset, &paddr);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID | (shared ? PTE_SHARED : PTE_COW);
+		return 0;
+	}
+
+	if (as_text_page(as, vpage, &v, &offset)) {
+		result = pagecache_get(v, offset, &paddr);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		return 0;
+	}
+
+	if (as_cluster(as, vpage) && vm_pagein_cluster(as, vpage) == 0) {
+		return 0;
+	}
+
+	kva = vm_allocpage();
+	if (kva == 0) {
+		return ENOMEM;
+	}
+	bzero((void *)kva, PAGE_SIZE);
+	result = as_fill_page(as, vpage, kva);
+	if (result) {
+		free_kpages(kva);
+		return result;
+	}
+	frame_setowner(KVADDR_TO_PADDR(kva), as, vpage);
+	*pte = KVADDR_TO_PADDR(kva) | PTE_VALID | PTE_DIRTY;
+	return 0;
+}
+
+void
+vm_prefault(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	vaddr_t vpage;
+	pte_t *pte;
+	int perms;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (vpage = start; vpage < end; vpage += PAGE_SIZE) {
+		perms = as_perms(as, vpage);
+		if (perms == 0) {
+			continue;
+		}
+		pte = pt_insert(as, vpage);
+		if (pte == NULL) {
+			return;
+		}
+		if (*pte & (PTE_VALID | PTE_BUSY)) {
+			continue;
+		}
+		if (vm_pagein(as, vpage, pte)) {
+			return;
+		}
+		if ((perms & RG_W) && (*pte & PTE_COW) == 0) {
+			*pte |= PTE_WRITE;
+		}
+	}
+}
+
+/*
+ * Write fault on a copy-on-write page: unless we turn out to be the
+ * last one sharing the frame, switch to a private copy of it.
+ */
+static
+int
+vm_cowbreak(struct addrspace *as, vaddr_t vpage, pte_t *pte)
+{
+	paddr_t oldpa;
+	vaddr_t kva;
+	pte_t newpte;
+
+	oldpa = *pte & PTE_FRAME;
+	newpte = (*pte & ~PTE_COW) | PTE_WRITE | PTE_DIRTY;
+
+	if (frame_refcount(oldpa) == 1) {
+		swap_dropcopy(oldpa);
+		frame_setowner(oldpa, as, vpage);
+		pt_update(as, vpage, pte, newpte);
+		return 0;
+	}
+
+	kva = vm_allocpage();
+	if (kva == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)kva, (void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	frame_setowner(KVADDR_TO_PADDR(kva), as, vpage);
+	pt_update(as, vpage, pte, KVADDR_TO_PADDR(kva) | (newpte & ~PTE_FRAME));
+	/* Whoever still shares the old frame claims it when they write. */
+	frame_disown(oldpa, as);
+	frame_decref(oldpa);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	vaddr_t vpage;
+	pte_t *pte;
+	uint32_t elo;
+	bool writable, pagedin;
+	int perms, result, spl;
+
+	vpage = faultaddress & PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faulttype != VM_FAULT_READONLY) {
+		spl = splhigh();
+		curcpu->c_tlbstats.tlbs_misses++;
+		splx(spl);
+	}
+
+ retry:
+	if (faulttype != VM_FAULT_READONLY &&
+	    pt_refill(as, vpage, faulttype == VM_FAULT_WRITE)) {
+		pt_prefetch(as, vpage);
+		return 0;
+	}
+
+	lock_acquire(as->as_lock);
+
+	perms = as_perms(as, vpage);
+	if (perms == 0) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	/* Text is writable while load_elf is filling it in. */
+	writable = (perms & RG_W) || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writable) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_insert(as, vpage);
+	if (pte == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	if (*pte & PTE_BUSY) {
+		/* On its way out to swap; wait, then page it back in. */
+		lock_release(as->as_lock);
+		swap_wait(as);
+		goto retry;
+	}
+	pagedin = false;
+	if ((*pte & PTE_VALID) == 0) {
+		result = vm_pagein(as, vpage, pte);
+		if (result) {
+			goto fail;
+		}
+		pagedin = true;
+		if ((perms & RG_W) && (*pte & PTE_COW) == 0) {
+			*pte |= PTE_WRITE;
+		}
+	}
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_COW)) {
+		result = vm_cowbreak(as, vpage, pte);
+		if (result) {
+			goto fail;
+		}
+	}
+	if (faulttype != VM_FAULT_READ &&
+	    (*pte & (PTE_WRITE | PTE_DIRTY)) == PTE_WRITE) {
+		/* First write since the page was read from or copied to swap */
+		swap_dropcopy(*pte & PTE_FRAME);
+		*pte |= PTE_DIRTY;
+	}
+	*pte |= PTE_REF;
+
+	/*
+	 * Shared pages stay read-only in the TLB until broken above,
+	 * and clean ones until they are first written.
+	 */
+	elo = (*pte & PTE_FRAME) | TLBLO_VALID;
+	if ((*pte & (PTE_WRITE | PTE_DIRTY)) == (PTE_WRITE | PTE_DIRTY) ||
+	    as->as_loading) {
+		elo |= TLBLO_DIRTY;
+	}
+	vm_tlbload(vpage, elo);
+
+	if (pagedin) {
+		vm_prefault(as, vpage + PAGE_SIZE, as_faultahead(as, vpage));
+	}
+	if (faulttype != VM_FAULT_READONLY && !as->as_loading) {
+		pt_prefetch(as, vpage);
+	}
+
+	lock_release(as->as_lock);
+	return 0;
+
+ fail:
+	lock_release(as->as_lock);
+	if (result == ENOMEM && swap_reclaim()) {
+		goto retry;
+	}
+	return result;
+}
+
+void
+vm_printtlbstats(void)
+{
+	struct tlbstats sum;
+	const struct tlbstats *ts;
+	unsigned i, n;
+
+	bzero(&sum, sizeof(sum));
+	kprintf("%-5s %10s %10s %10s %8s %8s %10s\n", "cpu", "misses",
+		"refills", "prefetches", "flushes", "kept", "shootdowns");
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		ts = &cpu_get(i)->c_tlbstats;
+		kprintf("%-5u %10u %10u %10u %8u %8u %10u\n", i,
+			ts->tlbs_misses, ts->tlbs_refills,
+			ts->tlbs_prefetches, ts->tlbs_flushes,
+			ts->tlbs_flushskips, ts->tlbs_shootdowns);
+		sum.tlbs_misses += ts->tlbs_misses;
+		sum.tlbs_refills += ts->tlbs_refills;
+		sum.tlbs_prefetches += ts->tlbs_prefetches;
+		sum.tlbs_flushes += ts->tlbs_flushes;
+		sum.tlbs_flushskips += ts->tlbs_flushskips;
+		sum.tlbs_shootdowns += ts->tlbs_shootdowns;
+	}
+	kprintf("%-5s %10u %10u %10u %8u %8u %10u\n", "all",
+		sum.tlbs_misses, sum.tlbs_refills, sum.tlbs_prefetches,
+		sum.tlbs_flushes, sum.tlbs_flushskips, sum.tlbs_shootdowns);
+}
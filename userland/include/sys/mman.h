@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_*, MAP_*, MS_* and MADV_* #defines from the kernel
+ */
+#include <kern/mman.h>
+
+/* What mmap returns on error */
+#define MAP_FAILED ((void *)-1)
+
+/*
+ * Memory mapping calls. mmap maps LEN bytes of the file open on FD,
+ * starting at the page-aligned offset POS, and returns the address it
+ * chose (ADDR is only a hint). Pages past the end of the file read as
+ * zero, and writes to them are not stored.
+ *
+ * A MAP_SHARED mapping shares its pages with every other mapping of
+ * the same file; msync or munmap (or exit) write changes back to the
+ * file. A MAP_PRIVATE mapping sees the file until it writes a page,
+ * and then has its own copy. With MAP_ANONYMOUS there is no file and
+ * the pages start out zero; MAP_SHARED then means shared with child
+ * processes, which keeps the pages in memory.
+ *
+ * madvise gives the advice for the pages in [ADDR, ADDR+LEN); the
+ * access pattern hints apply to the whole of each mapping touched.
+ * mincore sets one byte of VEC per page, to 1 if resident and 0 if not.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t pos);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+int madvise(void *addr, size_t len, int advice);
+int mincore(void *addr, size_t len, unsigned char *vec);
+
+#endif /* _SYS_MMAN_H_ */
@@ -1,5 +1,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -16,6 +18,9 @@ int
 main(int argc, char * argv[])
 {
         int fd, r, i, j , k;
+        struct iovec iov[2];
+        pid_t pid;
+        int status;
         (void) argc;
         (void) argv;
 
@@ -27,6 +32,18 @@ main(int argc, char * argv[])
         snprintf(buf, MAX_BUF, "**********\n* write() works for stderr\n");
         write(2, buf, strlen(buf));
 
+        snprintf(buf, MAX_BUF, "**********\n* writev() ");
+        snprintf(buf2, MAX_BUF, "works for stdout\n");
+        iov[0].iov_base = buf;
+        iov[0].iov_len = strlen(buf);
+        iov[1].iov_base = buf2;
+        iov[1].iov_len = strlen(buf2);
+        r = writev(1, iov, 2);
+        if (r != (int)(iov[0].iov_len + iov[1].iov_len)) {
+                printf("ERROR writev: %s\n", strerror(errno));
+                exit(1);
+        }
+
         printf("**********\n* opening new file \"test.file\"\n");
         fd = open("test.file", O_RDWR | O_CREAT, 0700); /* mode u=rw in octal */
         printf("* open() got fd %d\n", fd);
@@ -173,6 +190,60 @@ main(int argc, char * argv[])
 
 
         printf("* file lseek  okay\n");
+
+        printf("**********\n* testing pread\n");
+        r = pread(fd, buf, 10, 5);
+        if (r != 10) {
+                printf("ERROR pread: %s\n", strerror(errno));
+                exit(1);
+        }
+        if (memcmp(buf, &teststr[5], 10) != 0) {
+                printf("ERROR  file contents mismatch\n");
+                exit(1);
+        }
+        r = lseek(fd, 0, SEEK_CUR);
+        if (r != 15) {
+                printf("ERROR pread moved the file offset to %d\n", r);
+                exit(1);
+        }
+        printf("* file pread  okay\n");
+
+        printf("**********\n* testing fork\n");
+        pid = fork();
+        if (pid < 0) {
+                printf("ERROR fork: %s\n", strerror(errno));
+                exit(1);
+        }
+        if (pid == 0) {
+                /* our copy of buf is private once written */
+                buf[0] = '!';
+                _exit(buf[0] == '!' ? 3 : 1);
+        }
+        if (waitpid(pid, &status, 0) != pid) {
+                printf("ERROR waitpid: %s\n", strerror(errno));
+                exit(1);
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 3 || buf[0] == '!') {
+                printf("ERROR fork child status %d\n", status);
+                exit(1);
+        }
+        printf("* fork okay\n");
+
+        printf("**********\n* testing vfork\n");
+        pid = vfork();
+        if (pid < 0) {
+                printf("ERROR vfork: %s\n", strerror(errno));
+                exit(1);
+        }
+        if (pid == 0) {
+                _exit(5);
+        }
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 5) {
+                printf("ERROR vfork child status %d\n", status);
+                exit(1);
+        }
+        printf("* vfork okay\n");
         printf("* closing file\n");
         close(fd);
 